@@ -0,0 +1,131 @@
+#include "BinaryLog.h"
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// Formats registered so far and the .fmt file of the open binary log, shared by every BinaryLog
+static std::mutex formatsMutex;
+static std::vector<std::string> formats;
+static std::unordered_map<std::string, uint16_t> formatIds;
+static std::string formatsPath;
+
+static void AppendFormat(const std::string& path, uint16_t id, const std::string& format)
+{
+    std::ofstream file(path, std::ios::app);
+    file << id << '\t' << format << '\n';
+}
+
+BinaryLog::~BinaryLog()
+{
+    if (records != nullptr)
+        munmap(reinterpret_cast<char*>(records) - BinaryLogHeader::RECORDS_OFFSET, mapSize);
+}
+
+/*
+    Creates the log file, a log left by the previous run is kept as <path>.old
+*/
+bool BinaryLog::Open(const std::string& path, size_t recordCapacity)
+{
+    rename(path.c_str(), (path + ".old").c_str());
+    rename((path + ".fmt").c_str(), (path + ".old.fmt").c_str());
+
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return false;
+
+    size_t size = BinaryLogHeader::RECORDS_OFFSET + recordCapacity * sizeof(BinaryRecord);
+
+    if (ftruncate(fd, size) != 0) {
+        close(fd);
+        return false;
+    }
+
+    // Populated up front, so writers never take a page fault on a fresh record
+    void* map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED)
+        return false;
+
+    BinaryLogHeader* header = static_cast<BinaryLogHeader*>(map);
+    std::memcpy(header->magic, BINARY_LOG_MAGIC, sizeof(header->magic));
+    header->capacity = recordCapacity;
+    header->ticksPerSecond = Calibrate();
+    header->startTicks = Ticks();
+    header->startEpochNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+    records = reinterpret_cast<BinaryRecord*>(static_cast<char*>(map) + BinaryLogHeader::RECORDS_OFFSET);
+    capacity = recordCapacity;
+    mapSize = size;
+
+    std::lock_guard<std::mutex> lock(formatsMutex);
+    formatsPath = path + ".fmt";
+
+    for (size_t i = 0; i < formats.size(); i++)
+        AppendFormat(formatsPath, i, formats[i]);
+
+    return true;
+}
+
+uint16_t BinaryLog::Register(const char* format)
+{
+    std::lock_guard<std::mutex> lock(formatsMutex);
+
+    auto it = formatIds.find(format);
+    if (it != formatIds.end())
+        return it->second;
+
+    uint16_t id = formats.size();
+    formats.push_back(format);
+    formatIds.emplace(format, id);
+
+    if (!formatsPath.empty())
+        AppendFormat(formatsPath, id, format);
+
+    return id;
+}
+
+std::string BinaryLog::Substitute(std::string_view format, const std::vector<std::string>& values)
+{
+    std::string out;
+    out.reserve(format.size() + 32);
+
+    size_t arg = 0;
+    for (size_t i = 0; i < format.size(); i++) {
+        if (format[i] == '{' && i + 1 < format.size() && format[i + 1] == '}') {
+            if (arg < values.size())
+                out += values[arg++];
+            i++;
+            continue;
+        }
+        out += format[i];
+    }
+    return out;
+}
+
+/*
+    Ticks per second of Ticks(), measured against the steady clock over a few milliseconds
+*/
+double BinaryLog::Calibrate()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    auto start = std::chrono::steady_clock::now();
+    uint64_t startTicks = Ticks();
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    uint64_t ticks = Ticks() - startTicks;
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return ticks / seconds;
+#else
+    return 1e9;
+#endif
+}
@@ -0,0 +1,154 @@
+//
+// Binary log: fixed-size records in a memory mapped file, rendered offline by tools/LogDecode.
+//
+
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+// Records in the file, it wraps around once full. 64 bytes each
+#ifndef BINARY_LOG_RECORDS
+#define BINARY_LOG_RECORDS (1 << 20)
+#endif
+
+#define BINARY_LOG_MAGIC "PGNBLOG1"
+#define BINARY_LOG_MAX_ARGS 4
+
+// File header, records start at BinaryLogHeader::RECORDS_OFFSET
+struct BinaryLogHeader {
+    static const size_t RECORDS_OFFSET = 4096;
+
+    char magic[8];
+    uint64_t capacity;
+    uint64_t startTicks;
+    uint64_t startEpochNs;
+    double ticksPerSecond;
+};
+
+/*
+    One log line. sequence is written last, 0 means the record was never (completely) written.
+    Arguments are packed into data: integers as 8 bytes, strings as a length byte and the bytes, truncated to fit.
+*/
+struct BinaryRecord {
+    enum ArgKind : uint8_t { INT = 0, UINT = 1, STRING = 2 };
+
+    uint64_t sequence;
+    uint64_t ticks;
+    uint16_t format;
+    uint8_t type;
+    uint8_t count;
+    uint8_t kinds[BINARY_LOG_MAX_ARGS];
+    unsigned char data[40];
+};
+
+static_assert(sizeof(BinaryRecord) == 64, "binary log records must stay 64 bytes");
+
+class BinaryLog {
+public:
+    BinaryLog() = default;
+    ~BinaryLog();
+
+    BinaryLog(const BinaryLog&) = delete;
+    BinaryLog& operator=(const BinaryLog&) = delete;
+
+    bool Open(const std::string& path, size_t capacity = BINARY_LOG_RECORDS);
+
+    // Lock free, producers only share the sequence counter
+    template <typename... Args>
+    void Write(uint16_t format, uint8_t type, const Args&... args)
+    {
+        static_assert(sizeof...(Args) <= BINARY_LOG_MAX_ARGS, "too many binary log arguments");
+
+        uint64_t sequence = next.fetch_add(1, std::memory_order_relaxed) + 1;
+        BinaryRecord& record = records[(sequence - 1) % capacity];
+
+        std::atomic_ref<uint64_t>(record.sequence).store(0, std::memory_order_relaxed);
+
+        record.ticks = Ticks();
+        record.format = format;
+        record.type = type;
+        record.count = 0;
+
+        size_t used = 0;
+        (Put(record, used, args), ...);
+
+        std::atomic_ref<uint64_t>(record.sequence).store(sequence, std::memory_order_release);
+    }
+
+    // Id of a format string, the same string always gets the same id. Ids are listed in <path>.fmt
+    static uint16_t Register(const char* format);
+
+    // Text rendering of a format, {} are replaced by the arguments in order
+    template <typename... Args>
+    static std::string Format(std::string_view format, const Args&... args)
+    {
+        std::vector<std::string> values;
+        (values.push_back(ToString(args)), ...);
+        return Substitute(format, values);
+    }
+
+    static std::string Substitute(std::string_view format, const std::vector<std::string>& values);
+
+    static inline uint64_t Ticks()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+private:
+    template <typename T>
+    static void Put(BinaryRecord& record, size_t& used, const T& value)
+    {
+        if constexpr (std::is_integral_v<T>) {
+            if (used + 8 > sizeof(record.data))
+                return;
+
+            uint64_t raw = static_cast<uint64_t>(value);
+            std::memcpy(record.data + used, &raw, 8);
+            record.kinds[record.count++] = std::is_signed_v<T> ? BinaryRecord::INT : BinaryRecord::UINT;
+            used += 8;
+        } else {
+            std::string_view str(value);
+
+            if (used + 1 > sizeof(record.data))
+                return;
+
+            size_t length = std::min(str.size(), sizeof(record.data) - used - 1);
+            record.data[used] = static_cast<uint8_t>(length);
+            std::memcpy(record.data + used + 1, str.data(), length);
+            record.kinds[record.count++] = BinaryRecord::STRING;
+            used += 1 + length;
+        }
+    }
+
+    template <typename T>
+    static std::string ToString(const T& value)
+    {
+        if constexpr (std::is_integral_v<T>)
+            return std::to_string(value);
+        else
+            return std::string(std::string_view(value));
+    }
+
+    static double Calibrate();
+
+    BinaryRecord* records = nullptr;
+    size_t capacity = 0;
+    size_t mapSize = 0;
+    std::atomic<uint64_t> next = 0;
+};
@@ -0,0 +1,52 @@
+#include "Clock.h"
+
+#include <cstring>
+#include <pthread.h>
+
+Clock& Clock::Get()
+{
+    static Clock clock;
+    return clock;
+}
+
+Clock::Clock()
+{
+    logTime.store(logTimes[0], std::memory_order_relaxed);
+    Update();
+    thread = std::thread(&Clock::Run, this);
+}
+
+Clock::~Clock()
+{
+    running = false;
+    thread.join();
+}
+
+void Clock::Update()
+{
+    auto now = std::chrono::steady_clock::now();
+    monotonicNs.store(std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count(), std::memory_order_relaxed);
+
+    std::time_t current = std::time(nullptr);
+
+    if (current != epoch.load(std::memory_order_relaxed)) {
+        char* slot = logTimes[current % SLOTS];
+
+        struct tm local;
+        localtime_r(&current, &local);
+        strftime(slot, sizeof(logTimes[0]), "%a %b %e %H:%M:%S %Y", &local);
+
+        logTime.store(slot, std::memory_order_release);
+        epoch.store(current, std::memory_order_relaxed);
+    }
+}
+
+void Clock::Run()
+{
+    pthread_setname_np(pthread_self(), "clock");
+
+    while (running.load(std::memory_order_relaxed)) {
+        std::this_thread::sleep_for(std::chrono::microseconds(tick.load(std::memory_order_relaxed)));
+        Update();
+    }
+}
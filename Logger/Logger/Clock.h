@@ -0,0 +1,52 @@
+//
+// Coarse clock shared by the logger and the server hot paths.
+//
+
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <thread>
+
+/*
+    A background thread refreshes the time once per tick (1 ms by default). Readers get the epoch time,
+    a monotonic ns counter and a preformatted ctime style timestamp with a single atomic load each,
+    instead of a syscall or a ctime call per use. Values are at most one tick old.
+*/
+class Clock {
+public:
+    static Clock& Get();
+
+    ~Clock();
+
+    Clock(const Clock&) = delete;
+    Clock& operator=(const Clock&) = delete;
+
+    std::time_t Now() const { return epoch.load(std::memory_order_relaxed); }
+    uint64_t MonotonicNs() const { return monotonicNs.load(std::memory_order_relaxed); }
+
+    // "Mon Oct 19 08:39:55 2026", as ctime without the newline
+    std::string LogTime() const { return std::string(logTime.load(std::memory_order_acquire)); }
+
+    void SetTick(std::chrono::microseconds interval) { tick.store(interval.count(), std::memory_order_relaxed); }
+
+private:
+    Clock();
+    void Update();
+    void Run();
+
+    // The timestamp only changes once per second. It is written to the slot of its second and published
+    // through the pointer, a reader copying the previous one has several seconds before it is reused
+    static const int SLOTS = 8;
+    char logTimes[SLOTS][32] = {};
+    std::atomic<const char*> logTime;
+
+    std::atomic<std::time_t> epoch = 0;
+    std::atomic<uint64_t> monotonicNs = 0;
+    std::atomic<int64_t> tick = 1000;
+
+    std::atomic<bool> running = true;
+    std::thread thread;
+};
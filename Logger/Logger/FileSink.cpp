@@ -0,0 +1,90 @@
+#include "FileSink.h"
+#include "WriteAll.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+FileSink::FileSink(const std::string& path, uint64_t maxBytes, std::chrono::seconds maxAge) : path(path), maxBytes(maxBytes), maxAge(maxAge)
+{
+}
+
+FileSink::~FileSink()
+{
+    if (fd >= 0)
+        close(fd);
+}
+
+bool FileSink::Open()
+{
+    int file = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (file < 0)
+        return false;
+
+    struct stat st;
+    size = fstat(file, &st) == 0 ? st.st_size : 0;
+
+    if (fd >= 0)
+        close(fd);
+
+    fd = file;
+    opened = std::chrono::steady_clock::now();
+    return true;
+}
+
+bool FileSink::Write(const std::vector<std::string>& lines)
+{
+    if ((maxBytes > 0 && size >= maxBytes) || (maxAge.count() > 0 && std::chrono::steady_clock::now() - opened >= maxAge))
+        Rotate();
+
+    if (fd < 0)
+        return false;
+
+    for (auto& line : lines)
+        size += line.size();
+
+    return WriteLines(fd, lines);
+}
+
+bool FileSink::WriteLines(int fd, const std::vector<std::string>& lines)
+{
+    std::vector<iovec> iov;
+    iov.reserve(std::min<size_t>(lines.size(), IOV_MAX));
+
+    size_t next = 0;
+    while (next < lines.size()) {
+        iov.clear();
+        for (size_t i = next; i < lines.size() && iov.size() < IOV_MAX; i++)
+            iov.push_back(iovec{const_cast<char*>(lines[i].data()), lines[i].size()});
+
+        if (!WritevAll(fd, iov.data(), iov.size()))
+            return false;
+
+        next += iov.size();
+    }
+    return true;
+}
+
+/*
+    Renames the current file to <path>.<date> and starts a new one. Only the logger thread writes,
+    so producers keep queueing while this runs
+*/
+void FileSink::Rotate()
+{
+    time_t now = time(0);
+    char date[32];
+    strftime(date, sizeof(date), "%Y%m%d-%H%M%S", localtime(&now));
+
+    std::string rotated = path + "." + date;
+    for (int i = 1; access(rotated.c_str(), F_OK) == 0; i++)
+        rotated = path + "." + date + "." + std::to_string(i);
+
+    rename(path.c_str(), rotated.c_str());
+    Open();
+}
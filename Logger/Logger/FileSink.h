@@ -0,0 +1,37 @@
+//
+// Log file written in batches, rotated by size and age.
+//
+
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class FileSink {
+public:
+    FileSink(const std::string& path, uint64_t maxBytes, std::chrono::seconds maxAge);
+    ~FileSink();
+
+    FileSink(const FileSink&) = delete;
+    FileSink& operator=(const FileSink&) = delete;
+
+    bool Open();
+
+    // Called from the logger thread only, one writev per batch
+    bool Write(const std::vector<std::string>& lines);
+
+    // Writes every line with as few writev calls as IOV_MAX allows, retrying partial writes
+    static bool WriteLines(int fd, const std::vector<std::string>& lines);
+
+private:
+    void Rotate();
+
+    std::string path;
+    uint64_t maxBytes = 0;
+    std::chrono::seconds maxAge{0};
+
+    int fd = -1;
+    uint64_t size = 0;
+    std::chrono::steady_clock::time_point opened;
+};
@@ -0,0 +1,71 @@
+//
+// Per call site limits on how often a line is logged.
+//
+
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+
+#include "Clock.h"
+
+/*
+    Token bucket of perSecond tokens per second holding up to burst of them, lock free.
+    Kept as the time the bucket would be full again (GCRA), so a check is one load and one CAS.
+*/
+class LogThrottle {
+public:
+    LogThrottle(double perSecond, double burst)
+        : interval(static_cast<int64_t>(1e9 / perSecond)), tolerance(static_cast<int64_t>(1e9 / perSecond * (burst - 1)))
+    {
+    }
+
+    // True if this call may log. suppressed is set to the calls dropped since the last one that logged
+    bool Allow(uint64_t& suppressed)
+    {
+        int64_t now = Clock::Get().MonotonicNs();
+        int64_t full = fullAt.load(std::memory_order_relaxed);
+
+        while (true) {
+            int64_t next = std::max(full, now) + interval;
+
+            if (next - now > tolerance + interval) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+
+            if (fullAt.compare_exchange_weak(full, next, std::memory_order_relaxed))
+                break;
+        }
+
+        suppressed = dropped.exchange(0, std::memory_order_relaxed);
+        return true;
+    }
+
+private:
+    const int64_t interval;
+    const int64_t tolerance;
+    std::atomic<int64_t> fullAt = 0;
+    std::atomic<uint64_t> dropped = 0;
+};
+
+// Lets one call in every n through
+class LogSampler {
+public:
+    explicit LogSampler(uint64_t every) : every(every > 0 ? every : 1) {}
+
+    bool Allow(uint64_t& suppressed)
+    {
+        uint64_t n = calls.fetch_add(1, std::memory_order_relaxed);
+
+        if (n % every != 0)
+            return false;
+
+        suppressed = n == 0 ? 0 : every - 1;
+        return true;
+    }
+
+private:
+    const uint64_t every;
+    std::atomic<uint64_t> calls = 0;
+};
@@ -1,78 +1,230 @@
-
-
 #include "Logger.h"
 
-Logger::Logger()
+#include <pthread.h>
+#include <unistd.h>
+
+Logger::Logger(size_t capacity, OverflowPolicy policy) : logQueue(capacity), overflowPolicy(policy)
 {
+    colorConsole = isatty(STDOUT_FILENO);
     logThread = std::thread(&Logger::runLogger, this);
 }
 
 std::string Logger::GetTime()
 {
-    time_t now = time(0);
-    std::string time = ctime(&now);
-    time[time.length() - 1] = '\0';
-    return time;
+    return Clock::Get().LogTime();
+}
+
+bool Logger::ParseOverflowPolicy(const std::string &name, OverflowPolicy &policy)
+{
+    if (name == "block")
+        policy = OverflowPolicy::BLOCK;
+    else if (name == "drop")
+        policy = OverflowPolicy::DROP_NEWEST;
+    else if (name == "count")
+        policy = OverflowPolicy::COUNT_DROPS;
+    else
+        return false;
+
+    return true;
+}
+
+bool Logger::OpenFile(const std::string &path, uint64_t maxBytes, std::chrono::seconds maxAge)
+{
+    auto sink = std::make_unique<FileSink>(path, maxBytes, maxAge);
+
+    if (!sink->Open())
+        return false;
+
+    file = std::move(sink);
+    return true;
+}
+
+bool Logger::OpenBinary(const std::string &path)
+{
+    auto log = std::make_unique<BinaryLog>();
+
+    if (!log->Open(path))
+        return false;
+
+    binary = std::move(log);
+    return true;
+}
+
+bool Logger::ParseLevel(const std::string &name, int &severity)
+{
+    if (name == "debug")
+        severity = Severity(DEBUG);
+    else if (name == "info")
+        severity = Severity(INFO);
+    else if (name == "warning")
+        severity = Severity(WARNING);
+    else if (name == "error")
+        severity = Severity(ERROR);
+    else
+        return false;
+
+    return true;
 }
 
 void Logger::log(LogTypes type, std::string &&logMessage)
 {
+    if (!IsEnabled(type))
+        return;
+
+    Log log{type, std::move(logMessage)};
+
+    while (!logQueue.TryPush(log))
+    {
+        if (overflowPolicy != OverflowPolicy::BLOCK)
+        {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        std::this_thread::yield();
+    }
 
-    std::unique_lock<std::mutex> lock(logMutex);
-    logQueue.push(Log{type, logMessage});
-    lock.unlock();
-    queueCv.notify_all();
+    // Pairs with the fence in runLogger, either the logger sees the message or this sees it sleeping
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (sleeping.load(std::memory_order_relaxed))
+    {
+        wakeups.fetch_add(1, std::memory_order_relaxed);
+        wakeups.notify_one();
+    }
 }
 
 void Logger::runLogger()
 {
-    while (isRunning)
+    pthread_setname_np(pthread_self(), "logger");
+    uint64_t reported = 0;
+
+    std::vector<Log> batch;
+    batch.reserve(LOG_BATCH);
+
+    while (true)
     {
-        std::unique_lock<std::mutex> lock(logMutex);
-        while (logQueue.empty())
+        // Drains what was queued since the last wakeup, in batches written with one writev each
+        Log log;
+        while (batch.size() < LOG_BATCH && logQueue.TryPop(log))
+            batch.push_back(std::move(log));
+
+        if (overflowPolicy == OverflowPolicy::COUNT_DROPS && Dropped() != reported)
         {
-            queueCv.wait(lock); // lock is unlocked or cv is notified.
+            uint64_t total = Dropped();
+            batch.push_back(Log{WARNING, "DROPPED " + std::to_string(total - reported) + " LOG MESSAGES"});
+            reported = total;
         }
-        // FIFO
-        Log log = logQueue.front();
-        logQueue.pop();
 
-        std::stringstream ss;
-
-        switch (log.type)
+        if (!batch.empty())
         {
-        case INFO:
-            ss << GetTime() << " [INFO] "
-               << " " << log.logMessage;
-            std::cout << Bold(Color(ss.str(), KCYN, "")) << std::endl;
-            break;
+            Flush(batch);
+            continue;
+        }
 
-        case DEBUG:
-            ss << GetTime() << " [DEBUG] " << log.logMessage;
-            std::cout << Bold(Color(ss.str(), KMAG, "")) << std::endl;
+        if (!isRunning.load())
             break;
 
-        case DEBUG_DOWNLOAD:
-            ss << GetTime() << " [FILE] " << log.logMessage;
-            std::cout << Bold(Color(ss.str(), KMAG, "")) << "\r";
-            break;
+        uint32_t seen = wakeups.load(std::memory_order_relaxed);
+        sleeping.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
 
-        case WARNING:
-            ss << GetTime() << " [WARN] "
-               << " " << log.logMessage;
-            std::cout << Bold(Color(ss.str(), KYEL, "")) << std::endl;
-            break;
+        if (logQueue.TryPop(log))
+        {
+            sleeping.store(false, std::memory_order_relaxed);
+            batch.push_back(std::move(log));
+            continue;
+        }
 
-        case ERROR:
-            ss << GetTime() << " [ERROR] " << log.logMessage;
-            std::cout << Bold(Color(ss.str(), KRED, "")) << std::endl;
-            break;
+        if (isRunning.load())
+            wakeups.wait(seen);
+
+        sleeping.store(false, std::memory_order_relaxed);
+    }
+}
+
+/*
+    Writes a batch to the console and to the log file, then empties it. Only the console gets colors
+*/
+void Logger::Flush(std::vector<Log> &batch)
+{
+    std::vector<std::string> lines;
+    lines.reserve(batch.size());
+
+    for (auto &log : batch)
+        lines.push_back(FormatLine(log));
+
+    if (file)
+    {
+        std::vector<std::string> fileLines;
+        fileLines.reserve(lines.size());
+
+        for (auto &line : lines)
+            fileLines.push_back(line + "\n");
+
+        file->Write(fileLines);
+    }
+
+    if (console.load(std::memory_order_relaxed))
+    {
+        for (size_t i = 0; i < lines.size(); i++)
+        {
+            // Download progress overwrites itself on the console
+            const char *end = batch[i].type == DEBUG_DOWNLOAD ? "\r" : "\n";
+
+            if (!colorConsole)
+            {
+                lines[i] += end;
+                continue;
+            }
+
+            const char *color = KCYN;
+            switch (batch[i].type)
+            {
+            case INFO:
+                color = KCYN;
+                break;
+            case DEBUG:
+            case DEBUG_DOWNLOAD:
+                color = KMAG;
+                break;
+            case WARNING:
+                color = KYEL;
+                break;
+            case ERROR:
+                color = KRED;
+                break;
+            }
+            lines[i] = Bold(Color(lines[i], color, "")) + end;
         }
+
+        FileSink::WriteLines(STDOUT_FILENO, lines);
+    }
+
+    batch.clear();
+}
+
+std::string Logger::FormatLine(const Log &log)
+{
+    switch (log.type)
+    {
+    case INFO:
+        return GetTime() + " [INFO]  " + log.logMessage;
+    case DEBUG:
+        return GetTime() + " [DEBUG] " + log.logMessage;
+    case DEBUG_DOWNLOAD:
+        return GetTime() + " [FILE] " + log.logMessage;
+    case WARNING:
+        return GetTime() + " [WARN]  " + log.logMessage;
+    case ERROR:
+        return GetTime() + " [ERROR] " + log.logMessage;
     }
+    return GetTime() + " " + log.logMessage;
 }
 
 Logger::~Logger()
 {
     isRunning = false;
+    wakeups.fetch_add(1);
+    wakeups.notify_one();
     logThread.join();
-}
\ No newline at end of file
+}
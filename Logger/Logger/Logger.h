@@ -4,14 +4,19 @@
 
 #pragma once
 #include <iostream>
-#include <queue>
 #include <thread>
-#include <mutex>
-#include <condition_variable>
+#include <atomic>
 #include <ctime>
 #include <sstream>
+#include <memory>
+#include <vector>
 
 #include "Colors.h"
+#include "RingBuffer.h"
+#include "BinaryLog.h"
+#include "FileSink.h"
+#include "Clock.h"
+#include "LogThrottle.h"
 
 enum LogTypes{
     INFO,
@@ -22,27 +27,152 @@ enum LogTypes{
 
 };
 
+// Messages less severe than this are compiled out entirely, see Logger::Severity
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL 0
+#endif
+
+/*
+    Logs through logger only if the level is enabled, at compile time and then at runtime.
+    The message is not evaluated at all otherwise, so building it costs nothing when nobody reads it.
+*/
+#define LOG(logger, type, ...)                                  \
+    do {                                                        \
+        if constexpr (Logger::Severity(type) >= LOG_COMPILE_LEVEL) { \
+            if ((logger)->IsEnabled(type))                      \
+                (logger)->log(type, __VA_ARGS__);               \
+        }                                                       \
+    } while (0)
+
+/*
+    Same filtering as LOG, for a format with {} placeholders and up to 4 integer or string arguments.
+    With a binary log open only the format id and the raw arguments are recorded, nothing is formatted;
+    otherwise the line is formatted and logged as text.
+*/
+#define LOGF(logger, type, format, ...)                                                   \
+    do {                                                                                  \
+        if constexpr (Logger::Severity(type) >= LOG_COMPILE_LEVEL) {                      \
+            if ((logger)->IsEnabled(type)) {                                              \
+                static const uint16_t logFormat = BinaryLog::Register(format);            \
+                if (BinaryLog* binaryLog = (logger)->Binary())                            \
+                    binaryLog->Write(logFormat, type __VA_OPT__(,) __VA_ARGS__);          \
+                else                                                                      \
+                    (logger)->log(type, BinaryLog::Format(format __VA_OPT__(,) __VA_ARGS__)); \
+            }                                                                             \
+        }                                                                                 \
+    } while (0)
+
+/*
+    LOGF limited per call site, to at most perSecond lines a second with bursts of up to burst lines.
+    The first line let through after some were dropped is followed by how many were dropped.
+*/
+#define LOGF_THROTTLED(logger, type, perSecond, burst, format, ...)                       \
+    do {                                                                                  \
+        if constexpr (Logger::Severity(type) >= LOG_COMPILE_LEVEL) {                      \
+            static LogThrottle logThrottle(perSecond, burst);                             \
+            uint64_t logSuppressed = 0;                                                   \
+            if ((logger)->IsEnabled(type) && logThrottle.Allow(logSuppressed)) {          \
+                LOGF(logger, type, format __VA_OPT__(,) __VA_ARGS__);                     \
+                if (logSuppressed > 0)                                                    \
+                    LOGF(logger, type, "SUPPRESSED {} LINES LIKE: {}", logSuppressed, format); \
+            }                                                                             \
+        }                                                                                 \
+    } while (0)
+
+// LOGF for one call in every n at this call site
+#define LOGF_SAMPLED(logger, type, every, format, ...)                                    \
+    do {                                                                                  \
+        if constexpr (Logger::Severity(type) >= LOG_COMPILE_LEVEL) {                      \
+            static LogSampler logSampler(every);                                          \
+            uint64_t logSuppressed = 0;                                                   \
+            if ((logger)->IsEnabled(type) && logSampler.Allow(logSuppressed))             \
+                LOGF(logger, type, format __VA_OPT__(,) __VA_ARGS__);                     \
+        }                                                                                 \
+    } while (0)
+
+// Limits of the throttled per-packet lines, per call site
+#define LOG_PACKET_RATE 50
+#define LOG_PACKET_BURST 200
+
+// Most lines the logger thread writes with one writev
+#define LOG_BATCH 256
+
+/*
+    What log() does when the ring is full.
+    BLOCK: waits until the logger thread makes room, nothing is lost.
+    DROP_NEWEST: the new message is dropped.
+    COUNT_DROPS: the new message is dropped and the logger reports how many were dropped.
+*/
+enum class OverflowPolicy{
+    BLOCK,
+    DROP_NEWEST,
+    COUNT_DROPS,
+};
+
 class Logger {
 public:
-    Logger();
+    Logger(size_t capacity = 8192, OverflowPolicy policy = OverflowPolicy::BLOCK);
     ~Logger();
     void runLogger();
     void log(LogTypes type, std::string&& logMessage);
     std::string GetTime();
+
+    uint64_t Dropped() const { return dropped.load(std::memory_order_relaxed); }
+
+    // 0 debug, 1 info, 2 warning, 3 error
+    static constexpr int Severity(LogTypes type){
+        switch (type) {
+            case DEBUG:
+            case DEBUG_DOWNLOAD:
+                return 0;
+            case INFO:
+                return 1;
+            case WARNING:
+                return 2;
+            case ERROR:
+                return 3;
+        }
+        return 3;
+    }
+
+    bool IsEnabled(LogTypes type) const { return Severity(type) >= level.load(std::memory_order_relaxed); }
+    void SetLevel(int severity) { level.store(severity, std::memory_order_relaxed); }
+
+    // Also writes every line to a file, rotated past maxBytes or maxAge (0 disables either). Called once at startup
+    bool OpenFile(const std::string& path, uint64_t maxBytes, std::chrono::seconds maxAge);
+
+    // Console output can be turned off when logging to a file, colored only when stdout is a terminal
+    void SetConsole(bool enabled) { console.store(enabled, std::memory_order_relaxed); }
+
+    // Switches LOGF to binary records, meant to be called once at startup before any thread logs
+    bool OpenBinary(const std::string& path);
+    BinaryLog* Binary() const { return binary.get(); }
+
+    static bool ParseOverflowPolicy(const std::string& name, OverflowPolicy& policy);
+    static bool ParseLevel(const std::string& name, int& severity);
 private:
     struct Log{
         LogTypes type;
         std::string logMessage;
     };
 
-    bool isRunning = true;
-    std::thread logThread;
-    std::mutex logMutex;
-    std::queue<Log> logQueue;
-    std::condition_variable queueCv;
-
+    void Flush(std::vector<Log>& batch);
+    std::string FormatLine(const Log& log);
 
+    std::atomic<bool> isRunning = true;
+    std::thread logThread;
 
+    RingBuffer<Log> logQueue;
+    OverflowPolicy overflowPolicy;
+    std::atomic<uint64_t> dropped = 0;
+    std::atomic<int> level = 0;
+    std::unique_ptr<BinaryLog> binary;
 
+    std::unique_ptr<FileSink> file;
+    std::atomic<bool> console = true;
+    bool colorConsole = false;
 
-};
\ No newline at end of file
+    // The logger thread only sleeps once the ring is drained, producers only wake it when it sleeps
+    std::atomic<bool> sleeping = false;
+    std::atomic<uint32_t> wakeups = 0;
+};
@@ -0,0 +1,95 @@
+//
+// Bounded lock-free ring buffer, many producers and a single consumer.
+//
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+/*
+    Every slot carries a sequence number. A producer claims a position with a CAS on the head and publishes
+    the slot by bumping its sequence, the consumer only reads slots whose sequence says they are published.
+    Producers never wait on each other or on the consumer, a full ring is reported back to the caller.
+*/
+template <typename T>
+class RingBuffer {
+public:
+    explicit RingBuffer(size_t capacity)
+    {
+        size_t size = 2;
+        while (size < capacity)
+            size <<= 1;
+
+        mask = size - 1;
+        slots = std::make_unique<Slot[]>(size);
+
+        for (size_t i = 0; i < size; i++)
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    RingBuffer(const RingBuffer&) = delete;
+    RingBuffer& operator=(const RingBuffer&) = delete;
+
+    // False if the ring is full, value is left untouched in that case
+    bool TryPush(T& value)
+    {
+        size_t pos = head.load(std::memory_order_relaxed);
+        Slot* slot;
+
+        while (true)
+        {
+            slot = &slots[pos & mask];
+            size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+
+            if (diff == 0)
+            {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+
+        slot->value = std::move(value);
+        slot->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Only called from the consumer thread. False if there is nothing published yet
+    bool TryPop(T& value)
+    {
+        Slot& slot = slots[tail & mask];
+
+        if (slot.sequence.load(std::memory_order_acquire) != tail + 1)
+            return false;
+
+        value = std::move(slot.value);
+        slot.sequence.store(tail + mask + 1, std::memory_order_release);
+        tail++;
+        return true;
+    }
+
+    size_t Capacity() const { return mask + 1; }
+
+private:
+    struct Slot {
+        std::atomic<size_t> sequence{0};
+        T value;
+    };
+
+    std::unique_ptr<Slot[]> slots;
+    size_t mask = 0;
+
+    // Producers and the consumer touch different cache lines
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) size_t tail = 0;
+};
@@ -0,0 +1,35 @@
+//
+// Vectored writes that survive partial writes.
+//
+
+#pragma once
+#include <cstddef>
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/*
+    Writes every buffer of iov with as few writev calls as the fd allows, count must not exceed IOV_MAX.
+    iov is consumed: partially written entries are moved past what was written
+*/
+inline bool WritevAll(int fd, iovec* iov, size_t count)
+{
+    size_t done = 0;
+
+    while (done < count) {
+        ssize_t n = writev(fd, iov + done, count - done);
+        if (n < 0)
+            return false;
+
+        // Skips what was fully written and moves into a partially written buffer
+        while (done < count && static_cast<size_t>(n) >= iov[done].iov_len) {
+            n -= iov[done].iov_len;
+            done++;
+        }
+        if (done < count) {
+            iov[done].iov_base = static_cast<char*>(iov[done].iov_base) + n;
+            iov[done].iov_len -= n;
+        }
+    }
+    return true;
+}
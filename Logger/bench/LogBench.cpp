@@ -0,0 +1,113 @@
+//
+// Per-packet logging overhead. Logs what the server logs for one TEXT_MESSAGE (packet hex dump,
+// message line, broadcast line) and reports ns per packet with logging on, off at runtime, and against copying the payload once without logging.
+//
+//   g++ -O2 -std=c++20 LogBench.cpp ../Logger/Logger.cpp ../Logger/BinaryLog.cpp ../Logger/FileSink.cpp ../Logger/Clock.cpp -o LogBench && ./LogBench
+//   g++ -O2 -std=c++20 -DLOG_COMPILE_LEVEL=4 LogBench.cpp ../Logger/Logger.cpp ../Logger/BinaryLog.cpp ../Logger/FileSink.cpp ../Logger/Clock.cpp -o LogBench && ./LogBench   (compiled out)
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "../Logger/Logger.h"
+
+static const int PACKETS = 200000;
+
+// Same layout as the server packet dump, 16 bytes per line after the offset. Kept here so the bench only needs the logger
+static std::string HexDump(const std::vector<unsigned char>& data)
+{
+    static const char digits[] = "0123456789abcdef";
+    std::string out = "\n\n";
+    out.reserve(2 + data.size() * 3 + data.size() / 16 * 7 + 8);
+
+    for (size_t line = 0; line < data.size(); line += 16) {
+        for (int shift = 12; shift >= 0; shift -= 4)
+            out += digits[(line >> shift) & 0xF];
+        out += ": ";
+
+        size_t end = std::min(line + 16, data.size());
+        for (size_t i = line; i < end; i++) {
+            out += digits[data[i] >> 4];
+            out += digits[data[i] & 0xF];
+            out += ' ';
+        }
+        if (end - line == 16)
+            out += '\n';
+    }
+    out += '\n';
+    return out;
+}
+
+static std::vector<unsigned char> MakePacket()
+{
+    std::string packet = std::string(30, '\x01') + "hello there, this is a regular sized chat message";
+    return std::vector<unsigned char>(packet.begin(), packet.end());
+}
+
+template <typename F>
+static double NsPerPacket(F &&packet)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < PACKETS; i++)
+        packet(i);
+
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / PACKETS;
+}
+
+int main()
+{
+    // The logger thread writes to stdout, only the producer side is measured
+    if (!freopen("/dev/null", "w", stdout))
+        return 1;
+
+    auto packet = MakePacket();
+    std::string username = "alice";
+    std::string payload(packet.begin() + 30, packet.end());
+
+    Logger logger(1 << 16, OverflowPolicy::BLOCK);
+
+    auto logPacket = [&](int i)
+    {
+        LOG(&logger, DEBUG, "NEW PKT: " + HexDump(packet));
+        LOG(&logger, INFO, "TEXT MESSAGE BY: " + username + " " + payload);
+        LOG(&logger, DEBUG, "BROADCASTED " + std::to_string(i) + " BYTES");
+    };
+
+    double baseline = NsPerPacket([&](int)
+                                  { std::string copy = username + payload; asm volatile("" : : "r"(copy.data()) : "memory"); });
+
+    logger.SetLevel(Logger::Severity(DEBUG));
+    double enabled = NsPerPacket(logPacket);
+
+    logger.SetLevel(Logger::Severity(ERROR));
+    double disabled = NsPerPacket(logPacket);
+
+    // The same lines as LOGF, first formatted as text and then as binary records
+    auto logPacketFormat = [&](int i)
+    {
+        LOGF(&logger, DEBUG, "NEW PKT: {} BYTES", packet.size());
+        LOGF(&logger, INFO, "TEXT MESSAGE BY: {} {}", username, payload);
+        LOGF(&logger, DEBUG, "BROADCASTED {} BYTES", i);
+    };
+
+    logger.SetLevel(Logger::Severity(DEBUG));
+    double formatted = NsPerPacket(logPacketFormat);
+
+    if (!logger.OpenBinary("/tmp/LogBench.blog"))
+        return 1;
+
+    double binary = NsPerPacket(logPacketFormat);
+
+    fprintf(stderr, "compile level %d, %d packets\n", LOG_COMPILE_LEVEL, PACKETS);
+    fprintf(stderr, "payload copy only: %8.1f ns/packet\n", baseline);
+    fprintf(stderr, "logging on:        %8.1f ns/packet\n", enabled);
+    fprintf(stderr, "logging off:       %8.1f ns/packet\n", disabled);
+    fprintf(stderr, "LOGF as text:      %8.1f ns/packet\n", formatted);
+    fprintf(stderr, "LOGF binary:       %8.1f ns/packet\n", binary);
+    return 0;
+}
@@ -0,0 +1,136 @@
+//
+// Renders a binary log written by Logger::OpenBinary as text or as JSON lines.
+//
+//   g++ -O2 -std=c++20 LogDecode.cpp ../Logger/BinaryLog.cpp -o LogDecode
+//   ./LogDecode <log> [--json]
+//
+// The format table is read from <log>.fmt. Records are printed in the order they were written.
+//
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../Logger/BinaryLog.h"
+
+static const char* TypeName(uint8_t type)
+{
+    // Same order as LogTypes
+    static const char* names[] = {"INFO", "DEBUG", "WARN", "ERROR", "FILE"};
+    return type < 5 ? names[type] : "?";
+}
+
+static std::string JsonString(const std::string& str)
+{
+    std::string out = "\"";
+    for (unsigned char c : str) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+// Unpacks the arguments of a record, as strings for text and as json values
+static void Arguments(const BinaryRecord& record, std::vector<std::string>& text, std::vector<std::string>& json)
+{
+    size_t used = 0;
+
+    for (uint8_t i = 0; i < record.count && i < BINARY_LOG_MAX_ARGS; i++) {
+        if (record.kinds[i] == BinaryRecord::STRING) {
+            size_t length = std::min<size_t>(record.data[used], sizeof(record.data) - used - 1);
+            std::string value(reinterpret_cast<const char*>(record.data + used + 1), length);
+            text.push_back(value);
+            json.push_back(JsonString(value));
+            used += 1 + length;
+        } else {
+            uint64_t raw;
+            std::memcpy(&raw, record.data + used, 8);
+            std::string value = record.kinds[i] == BinaryRecord::INT ? std::to_string(static_cast<int64_t>(raw)) : std::to_string(raw);
+            text.push_back(value);
+            json.push_back(value);
+            used += 8;
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2) {
+        std::cerr << "usage: " << argv[0] << " <log> [--json]" << std::endl;
+        return 1;
+    }
+
+    std::string path = argv[1];
+    bool asJson = argc > 2 && std::string(argv[2]) == "--json";
+
+    std::ifstream file(path, std::ios::binary);
+    BinaryLogHeader header;
+
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || std::memcmp(header.magic, BINARY_LOG_MAGIC, sizeof(header.magic)) != 0) {
+        std::cerr << "not a binary log: " << path << std::endl;
+        return 1;
+    }
+
+    std::unordered_map<uint16_t, std::string> formats;
+    std::ifstream formatFile(path + ".fmt");
+    std::string line;
+
+    while (std::getline(formatFile, line)) {
+        size_t tab = line.find('\t');
+        if (tab != std::string::npos)
+            formats[std::stoi(line.substr(0, tab))] = line.substr(tab + 1);
+    }
+
+    std::vector<BinaryRecord> records(header.capacity);
+    file.seekg(BinaryLogHeader::RECORDS_OFFSET);
+    file.read(reinterpret_cast<char*>(records.data()), records.size() * sizeof(BinaryRecord));
+    records.resize(file.gcount() / sizeof(BinaryRecord));
+
+    records.erase(std::remove_if(records.begin(), records.end(), [](const BinaryRecord& r) { return r.sequence == 0; }), records.end());
+    std::sort(records.begin(), records.end(), [](const BinaryRecord& a, const BinaryRecord& b) { return a.sequence < b.sequence; });
+
+    for (auto& record : records) {
+        double elapsed = (static_cast<double>(record.ticks) - static_cast<double>(header.startTicks)) / header.ticksPerSecond;
+        int64_t epochNs = header.startEpochNs + static_cast<int64_t>(elapsed * 1e9);
+
+        auto format = formats.find(record.format);
+        std::string formatString = format != formats.end() ? format->second : "<unknown format " + std::to_string(record.format) + ">";
+
+        std::vector<std::string> text, json;
+        Arguments(record, text, json);
+        std::string message = BinaryLog::Substitute(formatString, text);
+
+        if (asJson) {
+            std::stringstream args;
+            for (size_t i = 0; i < json.size(); i++)
+                args << (i ? "," : "") << json[i];
+
+            std::cout << "{\"seq\":" << record.sequence << ",\"time_ns\":" << epochNs << ",\"level\":\"" << TypeName(record.type)
+                      << "\",\"format\":" << JsonString(formatString) << ",\"args\":[" << args.str() << "],\"message\":" << JsonString(message) << "}\n";
+            continue;
+        }
+
+        time_t seconds = epochNs / 1000000000;
+        char date[32];
+        strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", localtime(&seconds));
+
+        printf("%s.%06lld [%s] %s\n", date, static_cast<long long>((epochNs / 1000) % 1000000), TypeName(record.type), message.c_str());
+    }
+
+    return 0;
+}
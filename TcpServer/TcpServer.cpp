@@ -71,13 +71,13 @@ int TcpServer::Setup(){
 int TcpServer::Recv(std::vector<unsigned char>& buf, size_t toRecv, int total, SSL* ssl1, Logger* logger){
 
     if(logger)
-        logger->log(DEBUG, "DOWNLOADING PAYLOAD");
+        LOG(logger, DEBUG, "DOWNLOADING PAYLOAD");
 
     do{
         int nRecv = SSL_read(ssl1, buf.data() + total, toRecv - total);
         
         if(logger)
-            logger->log(DEBUG_DOWNLOAD, std::to_string(total) + " BYTES / " + std::to_string(toRecv) + " BYTES");
+            LOGF_THROTTLED(logger, DEBUG_DOWNLOAD, 10, 10, "{} BYTES / {} BYTES", total, toRecv);
 
         if(nRecv <= 0)
             break;
@@ -86,20 +86,24 @@ int TcpServer::Recv(std::vector<unsigned char>& buf, size_t toRecv, int total, S
     }while (total < toRecv);
     
     if(logger)
-            logger->log(DEBUG, std::to_string(total) + " BYTES / " + std::to_string(toRecv) + " BYTES");
+            LOGF(logger, DEBUG, "{} BYTES / {} BYTES", total, toRecv);
 
     return total;
 }
 
 int TcpServer::SendAll(std::vector<unsigned char>& buf, SSL* ssl){
+    return SendAll(buf.data(), buf.size(), ssl);
+}
+
+int TcpServer::SendAll(const unsigned char* buf, size_t size, SSL* ssl){
     int totalSent = 0;
-    int leftToSend = buf.size();
+    int leftToSend = size;
     int nSent;
 
-    while (totalSent < buf.size()) {
-        nSent = SSL_write(ssl, buf.data() + totalSent, leftToSend);
+    while (totalSent < size) {
+        nSent = SSL_write(ssl, buf + totalSent, leftToSend);
 
-        if (nSent < 0) {
+        if (nSent <= 0) {
             int error = SSL_get_error(ssl, nSent);
             //std::cout << "Error while sending: " << error << std::endl;
             break;
@@ -32,6 +32,7 @@ public:
 
     int Recv(std::vector<unsigned char>& buf, size_t toRecv, int total=0, SSL* ssl=nullptr, Logger* logger = nullptr);
     int SendAll(std::vector<unsigned char>& buf, SSL* ssl);
+    int SendAll(const unsigned char* buf, size_t size, SSL* ssl);
 public:
     inline int GetSocketFD(){ return sSocket;};
 
@@ -1,2 +1,2 @@
 #!/bin/bash
-g++ -o ./bin/server.out TcpServer/*.cpp Logger/Logger/*.cpp src/PigeonData.cpp src/PigeonServer.cpp src/main.cpp -lssl -ljsoncpp -lcrypto -std=c++20
+g++ -o ./bin/server.out TcpServer/*.cpp Logger/Logger/*.cpp src/PigeonData.cpp src/PigeonFrame.cpp src/MediaIndex.cpp src/SegmentStore.cpp src/MediaStore.cpp src/MediaCache.cpp src/IoPool.cpp src/History.cpp src/GroupCommit.cpp src/PacketCapture.cpp src/Metrics.cpp src/StatsServer.cpp src/PigeonServer.cpp src/main.cpp -lssl -ljsoncpp -lcrypto -std=c++20
@@ -0,0 +1,101 @@
+#include "GroupCommit.h"
+
+#include <pthread.h>
+
+GroupCommit::GroupCommit(std::function<bool()> flush) : m_flush(std::move(flush))
+{
+    m_thread = std::thread(&GroupCommit::Writer, this);
+}
+
+GroupCommit::~GroupCommit()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_running = false;
+    }
+    m_pending.notify_all();
+
+    m_thread.join();
+}
+
+/**
+ * @brief Waits until everything appended before the call is durable, as the durability level says.
+ * @return False if the flush failed.
+ */
+bool GroupCommit::Commit()
+{
+    Durability durability = GetDurability();
+
+    if (durability == Durability::NONE)
+        return true;
+
+    if (durability == Durability::WRITE)
+        return m_flush();
+
+    std::unique_lock<std::mutex> lock(m_mtx);
+
+    uint64_t ticket = ++m_requested;
+    m_pending.notify_one();
+
+    m_flushed.wait(lock, [this, ticket] { return m_durable >= ticket; });
+    return ticket <= m_failedFrom || ticket > m_failedTo;
+}
+
+/**
+ * @brief Maps the "durability" config value to its level.
+ * @return False if the name is not none, batch or write.
+ */
+bool GroupCommit::ParseDurability(const std::string &name, Durability &durability)
+{
+    if (name == "none")
+        durability = Durability::NONE;
+    else if (name == "batch")
+        durability = Durability::BATCH;
+    else if (name == "write")
+        durability = Durability::WRITE;
+    else
+        return false;
+
+    return true;
+}
+
+/*
+    Flushes one batch per window until destroyed. Tickets still pending on exit are flushed first so no writer is left waiting.
+*/
+void GroupCommit::Writer()
+{
+    pthread_setname_np(pthread_self(), "pgn-commit");
+
+    std::unique_lock<std::mutex> lock(m_mtx);
+
+    while (true)
+    {
+        m_pending.wait(lock, [this] { return !m_running || m_requested > m_durable; });
+
+        if (m_requested == m_durable)
+            return;
+
+        // Writers arriving during the window join this batch
+        if (m_running)
+        {
+            lock.unlock();
+            std::this_thread::sleep_for(std::chrono::milliseconds(GROUP_COMMIT_WINDOW_MS));
+            lock.lock();
+        }
+
+        uint64_t batch = m_requested;
+
+        lock.unlock();
+        bool ok = m_flush();
+        lock.lock();
+
+        if (!ok)
+        {
+            m_failedFrom = m_durable;
+            m_failedTo = batch;
+        }
+
+        m_durable = batch;
+        m_flushed.notify_all();
+    }
+}
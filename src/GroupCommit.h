@@ -0,0 +1,89 @@
+/*
+ *   @author jozese
+ *
+ *
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// How long the writer thread waits for more appends before flushing a batch
+#ifndef GROUP_COMMIT_WINDOW_MS
+#define GROUP_COMMIT_WINDOW_MS 2
+#endif
+
+/*
+    NONE: appends reach the disk whenever the kernel writes them back
+    BATCH: appends are flushed in batches by the writer thread, writers wait for their batch
+    WRITE: every append is flushed by its writer
+*/
+enum class Durability
+{
+    NONE,
+    BATCH,
+    WRITE,
+};
+
+/**
+ * @class GroupCommit
+ * @brief Makes appends to a log durable without a flush per append.
+ *
+ * Writers append to the log and then call Commit. In BATCH mode Commit hands a ticket to the writer thread
+ * and blocks; the writer thread waits GROUP_COMMIT_WINDOW_MS for more tickets and then runs the flush
+ * function once for all of them, so N concurrent writers cost one fdatasync instead of N.
+ */
+class GroupCommit
+{
+public:
+    GroupCommit(std::function<bool()> flush);
+    ~GroupCommit();
+
+    GroupCommit(const GroupCommit &) = delete;
+    GroupCommit &operator=(const GroupCommit &) = delete;
+
+public:
+    bool Commit();
+
+    inline void SetDurability(Durability durability)
+    {
+        m_durability.store(durability, std::memory_order_relaxed);
+    }
+
+    inline Durability GetDurability() const
+    {
+        return m_durability.load(std::memory_order_relaxed);
+    }
+
+    static bool ParseDurability(const std::string &name, Durability &durability);
+
+private:
+    void Writer();
+
+private:
+    std::function<bool()> m_flush;
+    std::atomic<Durability> m_durability{Durability::NONE};
+
+    std::mutex m_mtx;
+    std::condition_variable m_pending;
+    std::condition_variable m_flushed;
+
+    // Tickets handed out and tickets already flushed, a writer is done once m_durable reaches its ticket
+    uint64_t m_requested = 0;
+    uint64_t m_durable = 0;
+
+    // Tickets of the last batch whose flush failed, (from, to]
+    uint64_t m_failedFrom = 0;
+    uint64_t m_failedTo = 0;
+    bool m_running = true;
+
+    std::thread m_thread;
+};
@@ -0,0 +1,293 @@
+#include "History.h"
+
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// FNV-1a, chained so a record can be hashed in pieces
+static uint32_t Checksum(const unsigned char *data, size_t size, uint32_t hash = 2166136261u)
+{
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ data[i]) * 16777619u;
+
+    return hash;
+}
+
+History::History(const std::string &path, size_t depth) : m_path(path), m_depth(depth)
+{
+    m_fd = open(m_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+
+    struct stat st;
+    if (m_fd < 0 || fstat(m_fd, &st) != 0)
+    {
+        std::cerr << "Error opening history log" << std::endl;
+        return;
+    }
+
+    if (!Map(st.st_size > 0 ? st.st_size : HISTORY_GROW_STEP))
+    {
+        std::cerr << "Error mapping history log" << std::endl;
+        return;
+    }
+
+    Load();
+}
+
+History::~History()
+{
+    if (m_map != nullptr)
+        munmap(m_map, m_mapSize);
+
+    if (m_fd >= 0)
+        close(m_fd);
+}
+
+/**
+ * @brief Records a frame sent to a channel, in the log and in the channel ring.
+ * @param channel Channel the frame was sent to.
+ * @param frame Serialized frame, exactly as sent.
+ */
+void History::Append(const std::string &channel, const std::vector<unsigned char> &frame)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+
+        if (m_depth == 0)
+            return;
+
+        Write(channel, frame);
+        Push(channel, std::make_shared<const std::vector<unsigned char>>(frame));
+    }
+
+    // Outside the lock, so appends from other connections join the same batch
+    m_commit.Commit();
+}
+
+/**
+ * @brief Last frames of a channel, oldest first, concatenated so they can be sent with a single write.
+ */
+std::vector<unsigned char> History::Tail(const std::string &channel)
+{
+    std::vector<Frame> frames;
+    size_t size = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+
+        auto ring = m_rings.find(channel);
+        if (ring == m_rings.end())
+            return {};
+
+        for (auto &frame : ring->second)
+        {
+            frames.push_back(frame);
+            size += frame->size();
+        }
+    }
+
+    std::vector<unsigned char> tail;
+    tail.reserve(size);
+
+    for (auto &frame : frames)
+        tail.insert(tail.end(), frame->begin(), frame->end());
+
+    return tail;
+}
+
+/*
+    Changes how many frames per channel are kept, 0 disables the history
+*/
+void History::SetDepth(size_t depth)
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+
+    m_depth = depth;
+
+    for (auto &ring : m_rings)
+    {
+        while (ring.second.size() > m_depth)
+            ring.second.pop_front();
+    }
+}
+
+/*
+    Grows the file to size if needed and maps it. History mutex must be held
+*/
+bool History::Map(size_t size)
+{
+    if (m_map != nullptr)
+    {
+        munmap(m_map, m_mapSize);
+        m_map = nullptr;
+        m_mapSize = 0;
+    }
+
+    struct stat st;
+    if (fstat(m_fd, &st) != 0)
+        return false;
+
+    if ((size_t)st.st_size < size && ftruncate(m_fd, size) != 0)
+        return false;
+
+    void *map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+
+    if (map == MAP_FAILED)
+        return false;
+
+    m_map = static_cast<unsigned char *>(map);
+    m_mapSize = size;
+    return true;
+}
+
+/*
+    Replays the log into the rings and finds where the next record goes. The shared mapping can reach the disk
+    in any order, so a record torn by a crash fails its checksum and the log ends right before it.
+*/
+void History::Load()
+{
+    m_offset = 0;
+
+    while (m_offset + HISTORY_HEADER_SIZE <= m_mapSize)
+    {
+        uint32_t length = 0;
+        std::memcpy(&length, m_map + m_offset, sizeof(uint32_t));
+
+        if (length == 0 || m_offset + HISTORY_HEADER_SIZE + length > m_mapSize)
+            break;
+
+        uint32_t checksum = 0;
+        std::memcpy(&checksum, m_map + m_offset + sizeof(uint32_t), sizeof(uint32_t));
+
+        const unsigned char *record = m_map + m_offset + HISTORY_HEADER_SIZE;
+        uint8_t channelLength = record[0];
+
+        if (channelLength + 1u > length || Checksum(record, length) != checksum)
+            break;
+
+        std::string channel(reinterpret_cast<const char *>(record + 1), channelLength);
+        auto frame = std::make_shared<const std::vector<unsigned char>>(record + 1 + channelLength, record + length);
+
+        Push(channel, std::move(frame));
+        m_offset += HISTORY_HEADER_SIZE + length;
+    }
+}
+
+/*
+    Writes one record into the mapping, growing or rewriting the log when it is full. History mutex must be held
+*/
+bool History::Write(const std::string &channel, const std::vector<unsigned char> &frame)
+{
+    if (m_map == nullptr || channel.size() > 255)
+        return false;
+
+    uint32_t length = 1 + channel.size() + frame.size();
+    size_t recordSize = HISTORY_HEADER_SIZE + length;
+
+    uint8_t channelLength = static_cast<uint8_t>(channel.size());
+    uint32_t checksum = Checksum(&channelLength, 1);
+    checksum = Checksum(reinterpret_cast<const unsigned char *>(channel.data()), channel.size(), checksum);
+    checksum = Checksum(frame.data(), frame.size(), checksum);
+
+    if (m_offset + recordSize + sizeof(uint32_t) > m_mapSize)
+    {
+        if (m_offset + recordSize + sizeof(uint32_t) > HISTORY_MAX_SIZE)
+        {
+            if (!Rewrite())
+                return false;
+        }
+
+        size_t size = m_mapSize;
+        while (m_offset + recordSize + sizeof(uint32_t) > size)
+            size += HISTORY_GROW_STEP;
+
+        if (size != m_mapSize && !Map(size))
+            return false;
+    }
+
+    unsigned char *out = m_map + m_offset;
+
+    std::memcpy(out, &length, sizeof(uint32_t));
+    std::memcpy(out + sizeof(uint32_t), &checksum, sizeof(uint32_t));
+    out[HISTORY_HEADER_SIZE] = channelLength;
+    std::memcpy(out + HISTORY_HEADER_SIZE + 1, channel.data(), channel.size());
+    std::memcpy(out + HISTORY_HEADER_SIZE + 1 + channel.size(), frame.data(), frame.size());
+
+    m_offset += recordSize;
+    return true;
+}
+
+/*
+    Starts a fresh log holding only the frames still in the rings. History mutex must be held
+*/
+bool History::Rewrite()
+{
+    std::string tmpPath = m_path + ".tmp";
+    int fd = open(tmpPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (fd < 0)
+        return false;
+
+    std::vector<unsigned char> buffer;
+
+    for (auto &ring : m_rings)
+    {
+        for (auto &frame : ring.second)
+        {
+            uint32_t length = 1 + ring.first.size() + frame->size();
+            unsigned char *lengthBytes = reinterpret_cast<unsigned char *>(&length);
+
+            size_t start = buffer.size();
+            buffer.insert(buffer.end(), lengthBytes, lengthBytes + sizeof(uint32_t));
+            buffer.insert(buffer.end(), sizeof(uint32_t), 0);
+            buffer.push_back(static_cast<uint8_t>(ring.first.size()));
+            buffer.insert(buffer.end(), ring.first.begin(), ring.first.end());
+            buffer.insert(buffer.end(), frame->begin(), frame->end());
+
+            uint32_t checksum = Checksum(buffer.data() + start + HISTORY_HEADER_SIZE, length);
+            std::memcpy(buffer.data() + start + sizeof(uint32_t), &checksum, sizeof(uint32_t));
+        }
+    }
+
+    bool ok = write(fd, buffer.data(), buffer.size()) == (ssize_t)buffer.size() && fdatasync(fd) == 0;
+
+    if (!ok || rename(tmpPath.c_str(), m_path.c_str()) != 0)
+    {
+        close(fd);
+        unlink(tmpPath.c_str());
+        return false;
+    }
+
+    {
+        std::unique_lock<std::shared_mutex> fdLock(m_fdMtx);
+        close(m_fd);
+        m_fd = fd;
+    }
+    m_offset = buffer.size();
+
+    return Map(m_offset + HISTORY_GROW_STEP);
+}
+
+/*
+    Group commit flush. On Linux fdatasync also writes back the dirty pages of the shared mapping
+*/
+bool History::Flush()
+{
+    std::shared_lock<std::shared_mutex> lock(m_fdMtx);
+    return m_fd >= 0 && fdatasync(m_fd) == 0;
+}
+
+/*
+    History mutex must be held
+*/
+void History::Push(const std::string &channel, Frame frame)
+{
+    auto &ring = m_rings[channel];
+    ring.push_back(std::move(frame));
+
+    while (ring.size() > m_depth)
+        ring.pop_front();
+}
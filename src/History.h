@@ -0,0 +1,86 @@
+/*
+ *   @author jozese
+ *
+ *
+ *
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "GroupCommit.h"
+
+// The log is grown in steps of this size, the unused tail is zero filled
+#define HISTORY_GROW_STEP (16 * 1024 * 1024)
+
+// Length and checksum in front of every record
+#define HISTORY_HEADER_SIZE (2 * sizeof(uint32_t))
+
+// Once the log would grow past this it is rewritten with only what is in the rings
+#define HISTORY_MAX_SIZE (256 * 1024 * 1024)
+
+/**
+ * @class History
+ * @brief Persistent history of the frames sent to channels.
+ *
+ * Every frame multicasted to a channel is appended to a memory mapped, append only log and kept in
+ * an in-memory ring of the last N frames of its channel. The log is replayed into the rings at startup,
+ * so a restart does not lose the recent history. Frames are kept serialized, replaying them is a copy.
+ *
+ * Record layout: [uint32 length of the rest][uint32 checksum of the rest][uint8 channel length][channel][frame].
+ * A zero length marks the end.
+ */
+class History
+{
+public:
+    History(const std::string &path, size_t depth);
+    ~History();
+
+    History(const History &) = delete;
+    History &operator=(const History &) = delete;
+
+public:
+    void Append(const std::string &channel, const std::vector<unsigned char> &frame);
+    std::vector<unsigned char> Tail(const std::string &channel);
+    void SetDepth(size_t depth);
+
+    inline void SetDurability(Durability durability)
+    {
+        m_commit.SetDurability(durability);
+    }
+
+private:
+    using Frame = std::shared_ptr<const std::vector<unsigned char>>;
+
+    bool Map(size_t size);
+    void Load();
+    bool Rewrite();
+    bool Write(const std::string &channel, const std::vector<unsigned char> &frame);
+    bool Flush();
+    void Push(const std::string &channel, Frame frame);
+
+private:
+    std::string m_path = "";
+    std::mutex m_mtx;
+
+    int m_fd = -1;
+
+    // Only taken exclusively to swap m_fd, so a flush never holds m_mtx
+    std::shared_mutex m_fdMtx;
+    unsigned char *m_map = nullptr;
+    size_t m_mapSize = 0;
+    size_t m_offset = 0;
+
+    size_t m_depth = 0;
+    std::unordered_map<std::string, std::deque<Frame>> m_rings;
+
+    GroupCommit m_commit{[this] { return Flush(); }};
+};
@@ -0,0 +1,49 @@
+#include "IoPool.h"
+
+#include <pthread.h>
+
+IoPool::IoPool(size_t threads, const char *name) : m_name(name)
+{
+    if (threads == 0)
+        threads = 1;
+
+    for (size_t i = 0; i < threads; i++)
+        m_threads.emplace_back(&IoPool::Worker, this);
+}
+
+IoPool::~IoPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_running = false;
+    }
+    m_cv.notify_all();
+
+    for (auto &t : m_threads)
+        t.join();
+}
+
+/*
+    Runs queued tasks until the pool is destroyed. Pending tasks are still run before exiting so no future is left without a result.
+*/
+void IoPool::Worker()
+{
+    pthread_setname_np(pthread_self(), m_name);
+
+    while (true)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(m_mtx);
+            m_cv.wait(lock, [this] { return !m_running || !m_queue.empty(); });
+
+            if (m_queue.empty())
+                return;
+
+            task = std::move(m_queue.front());
+            m_queue.pop();
+            m_pending.store(m_queue.size(), std::memory_order_relaxed);
+        }
+        task();
+    }
+}
@@ -0,0 +1,72 @@
+/*
+ *   @author jozese
+ *
+ *
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/**
+ * @class IoPool
+ * @brief Dedicated threads for disk I/O. Client threads submit the disk work and wait for the result
+ * through a future, so no lock is held while it runs and the pool bounds how much disk work runs at once.
+ * Tasks run in order, work that should not queue behind another kind of work goes to its own pool.
+ */
+class IoPool
+{
+public:
+    IoPool(size_t threads, const char *name = "pgn-io");
+    ~IoPool();
+
+    IoPool(const IoPool &) = delete;
+    IoPool &operator=(const IoPool &) = delete;
+
+public:
+    template <typename F>
+    auto Submit(F &&task) -> std::future<std::invoke_result_t<F>>
+    {
+        using Result = std::invoke_result_t<F>;
+
+        auto packaged = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(task));
+        auto future = packaged->get_future();
+
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_queue.push([packaged] { (*packaged)(); });
+            m_pending.store(m_queue.size(), std::memory_order_relaxed);
+        }
+        m_cv.notify_one();
+
+        return future;
+    }
+
+    // Read without the lock, so metrics never make a submitter wait
+    inline size_t Pending() const
+    {
+        return m_pending.load(std::memory_order_relaxed);
+    }
+
+private:
+    void Worker();
+
+private:
+    const char *m_name = nullptr;
+    std::vector<std::thread> m_threads;
+    std::queue<std::function<void()>> m_queue;
+    std::atomic<size_t> m_pending{0};
+    std::mutex m_mtx;
+    std::condition_variable m_cv;
+    bool m_running = true;
+};
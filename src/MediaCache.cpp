@@ -0,0 +1,141 @@
+#include "MediaCache.h"
+
+MediaCache::MediaCache(size_t budget) : m_shardBudget(budget / SHARDS)
+{
+}
+
+/**
+ * @brief Returns the cached frame for key, or loads it. Concurrent misses for the same key share one load.
+ * @param key User visible file name.
+ * @param loader Called on a miss, may return nullptr if the file does not exist or should not be cached.
+ * @return The frame, nullptr if the loader returned nullptr.
+ */
+std::shared_ptr<const FrameTemplate> MediaCache::GetOrLoad(const std::string &key, const Loader &loader)
+{
+    Shard &shard = GetShard(key);
+    std::promise<std::shared_ptr<const FrameTemplate>> promise;
+    uint64_t generation = 0;
+
+    {
+        std::unique_lock<std::mutex> lock(shard.mtx);
+
+        auto it = shard.entries.find(key);
+        if (it != shard.entries.end())
+        {
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+            m_hits.fetch_add(1, std::memory_order_relaxed);
+            return it->second->frame;
+        }
+
+        auto pending = shard.loading.find(key);
+        if (pending != shard.loading.end())
+        {
+            auto future = pending->second.frame;
+            lock.unlock();
+
+            m_coalesced.fetch_add(1, std::memory_order_relaxed);
+            return future.get();
+        }
+
+        generation = ++shard.generation;
+        shard.loading.emplace(key, Loading{promise.get_future().share(), generation});
+    }
+
+    m_misses.fetch_add(1, std::memory_order_relaxed);
+
+    std::shared_ptr<const FrameTemplate> frame = nullptr;
+    try
+    {
+        frame = loader();
+    }
+    catch (...)
+    {
+        frame = nullptr;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(shard.mtx);
+
+        // An Erase during the load dropped it, the frame may be of the deleted file and is not cached
+        auto pending = shard.loading.find(key);
+        if (pending != shard.loading.end() && pending->second.generation == generation)
+        {
+            shard.loading.erase(pending);
+            if (frame)
+                Insert(shard, key, frame);
+        }
+    }
+
+    promise.set_value(frame);
+    return frame;
+}
+
+/*
+    Removes a key, used when a file is deleted. A load in flight is forgotten, callers from now on load again
+*/
+void MediaCache::Erase(const std::string &key)
+{
+    Shard &shard = GetShard(key);
+    std::lock_guard<std::mutex> lock(shard.mtx);
+
+    shard.loading.erase(key);
+
+    auto it = shard.entries.find(key);
+    if (it != shard.entries.end())
+    {
+        shard.bytes -= it->second->bytes;
+        shard.lru.erase(it->second);
+        shard.entries.erase(it);
+    }
+}
+
+/*
+    Changes the total budget, shrinking it evicts right away
+*/
+void MediaCache::SetBudget(size_t budget)
+{
+    m_shardBudget.store(budget / SHARDS, std::memory_order_relaxed);
+
+    for (Shard &shard : m_shards)
+    {
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        Evict(shard, budget / SHARDS);
+    }
+}
+
+MediaCache::Shard &MediaCache::GetShard(const std::string &key)
+{
+    return m_shards[std::hash<std::string>{}(key) % SHARDS];
+}
+
+/*
+    Shard mutex must be held
+*/
+void MediaCache::Insert(Shard &shard, const std::string &key, std::shared_ptr<const FrameTemplate> frame)
+{
+    size_t budget = m_shardBudget.load(std::memory_order_relaxed);
+    size_t bytes = frame->Tail().size() + key.size() + sizeof(Entry);
+
+    if (bytes > budget || shard.entries.count(key) > 0)
+        return;
+
+    Evict(shard, budget - bytes);
+
+    shard.lru.push_front(Entry{key, std::move(frame), bytes});
+    shard.entries[key] = shard.lru.begin();
+    shard.bytes += bytes;
+}
+
+/*
+    Drops least recently used entries until the shard fits in budget. Shard mutex must be held
+*/
+void MediaCache::Evict(Shard &shard, size_t budget)
+{
+    while (shard.bytes > budget && !shard.lru.empty())
+    {
+        Entry &last = shard.lru.back();
+        shard.bytes -= last.bytes;
+        shard.entries.erase(last.key);
+        shard.lru.pop_back();
+    }
+}
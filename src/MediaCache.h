@@ -0,0 +1,89 @@
+/*
+ *   @author jozese
+ *
+ *
+ *
+ */
+
+#pragma once
+
+#include "PigeonFrame.h"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+/**
+ * @class MediaCache
+ * @brief Sharded LRU cache of pre-serialized ACK_MEDIA_DOWNLOAD frames, bounded by a byte budget.
+ *
+ * Concurrent misses for the same key are coalesced, only the first caller runs the loader and
+ * everyone else waits for its result.
+ */
+class MediaCache
+{
+public:
+    using Loader = std::function<std::shared_ptr<const FrameTemplate>()>;
+
+    MediaCache(size_t budget);
+
+public:
+    std::shared_ptr<const FrameTemplate> GetOrLoad(const std::string &key, const Loader &loader);
+    void Erase(const std::string &key);
+    void SetBudget(size_t budget);
+
+    // Biggest frame that can be cached, bigger ones should be served without going through the cache
+    inline size_t MaxEntry() const
+    {
+        return m_shardBudget.load(std::memory_order_relaxed);
+    }
+
+    inline uint64_t Hits() const { return m_hits.load(std::memory_order_relaxed); }
+    inline uint64_t Misses() const { return m_misses.load(std::memory_order_relaxed); }
+    inline uint64_t Coalesced() const { return m_coalesced.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr size_t SHARDS = 16;
+
+    struct Entry
+    {
+        std::string key;
+        std::shared_ptr<const FrameTemplate> frame;
+        size_t bytes;
+    };
+
+    struct Loading
+    {
+        std::shared_future<std::shared_ptr<const FrameTemplate>> frame;
+        // Tells a load apart from a later load of the same key started after an Erase
+        uint64_t generation;
+    };
+
+    struct Shard
+    {
+        std::mutex mtx;
+        std::list<Entry> lru; // most recently used first
+        std::unordered_map<std::string, std::list<Entry>::iterator> entries;
+        std::unordered_map<std::string, Loading> loading;
+        uint64_t generation = 0;
+        size_t bytes = 0;
+    };
+
+    Shard &GetShard(const std::string &key);
+    void Insert(Shard &shard, const std::string &key, std::shared_ptr<const FrameTemplate> frame);
+    void Evict(Shard &shard, size_t budget);
+
+private:
+    Shard m_shards[SHARDS];
+    std::atomic<size_t> m_shardBudget;
+
+    std::atomic<uint64_t> m_hits{0};
+    std::atomic<uint64_t> m_misses{0};
+    std::atomic<uint64_t> m_coalesced{0};
+};
@@ -0,0 +1,392 @@
+#include "MediaIndex.h"
+
+#include <fstream>
+#include <functional>
+#include <mutex>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+BloomFilter::BloomFilter(size_t capacity) : m_capacity(capacity)
+{
+    // ~10 bits per key with 7 hashes gives ~1% false positives
+    size_t bits = capacity * 10;
+    m_bits.assign((bits + 63) / 64, 0);
+}
+
+/*
+    Double hashing, the k positions are h1 + i * h2
+*/
+static inline void BloomHashes(const std::string &key, uint64_t &h1, uint64_t &h2)
+{
+    h1 = std::hash<std::string>{}(key);
+
+    // FNV-1a as the second, independent hash
+    h2 = 1469598103934665603ULL;
+    for (unsigned char c : key)
+    {
+        h2 ^= c;
+        h2 *= 1099511628211ULL;
+    }
+    h2 |= 1;
+}
+
+void BloomFilter::Add(const std::string &key)
+{
+    uint64_t h1, h2;
+    BloomHashes(key, h1, h2);
+
+    size_t bits = m_bits.size() * 64;
+    for (int i = 0; i < HASHES; i++)
+    {
+        size_t bit = (h1 + i * h2) % bits;
+        m_bits[bit / 64] |= (1ULL << (bit % 64));
+    }
+}
+
+bool BloomFilter::MayContain(const std::string &key) const
+{
+    uint64_t h1, h2;
+    BloomHashes(key, h1, h2);
+
+    size_t bits = m_bits.size() * 64;
+    for (int i = 0; i < HASHES; i++)
+    {
+        size_t bit = (h1 + i * h2) % bits;
+        if (!(m_bits[bit / 64] & (1ULL << (bit % 64))))
+            return false;
+    }
+    return true;
+}
+
+MediaIndex::MediaIndex(const std::string &path) : m_path(path)
+{
+}
+
+MediaIndex::~MediaIndex()
+{
+    if (m_fd >= 0)
+        close(m_fd);
+}
+
+/**
+ * @brief Replays the index file into memory and opens it for appending. A missing file is an empty index.
+ * @return False if the index file could not be opened for writing.
+ */
+bool MediaIndex::Load()
+{
+    std::unique_lock<std::shared_mutex> lock(m_mtx);
+
+    std::ifstream file(m_path);
+    std::string line;
+    Json::CharReaderBuilder builder;
+    std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+
+    while (std::getline(file, line))
+    {
+        Json::Value record;
+
+        // A torn last line after a crash is skipped, every record before it is still valid
+        if (line.empty() || !reader->parse(line.data(), line.data() + line.size(), &record, nullptr) || !record.isObject())
+            continue;
+
+        Apply(record);
+    }
+
+    while (m_bloom.Capacity() < m_entries.size() * 2)
+        m_bloom = BloomFilter(m_bloom.Capacity() * 2);
+
+    for (auto &entry : m_entries)
+        m_bloom.Add(entry.first);
+
+    m_fd = open(m_path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    return m_fd >= 0;
+}
+
+/*
+    Replays one record into the tables. Index lock must be held
+*/
+void MediaIndex::Apply(const Json::Value &record)
+{
+    std::string op = record.get("op", "put").asString();
+
+    if (op == "put" && record["name"].isString())
+    {
+        MediaEntry entry = FromJson(record);
+
+        if (m_entries.count(entry.name) > 0)
+            return;
+
+        if (!entry.hash.empty())
+        {
+            // Only the first name of a hash says where the blob is, later ones reuse it
+            auto blob = m_blobs.find(entry.hash);
+            if (blob == m_blobs.end())
+                blob = m_blobs.emplace(entry.hash, Blob{entry.location, 0}).first;
+            blob->second.references++;
+        }
+
+        m_entries[entry.name] = entry;
+    }
+    else if (op == "move" && record["hash"].isString())
+    {
+        auto blob = m_blobs.find(record["hash"].asString());
+        if (blob != m_blobs.end())
+        {
+            blob->second.location.segment = record.get("segment", -1).asInt64();
+            blob->second.location.offset = record.get("offset", 0).asUInt64();
+        }
+    }
+    else if (op == "del" && record["name"].isString())
+    {
+        auto it = m_entries.find(record["name"].asString());
+        if (it == m_entries.end())
+            return;
+
+        auto blob = m_blobs.find(it->second.hash);
+        if (blob != m_blobs.end() && --blob->second.references == 0)
+            m_blobs.erase(blob);
+
+        m_entries.erase(it);
+    }
+}
+
+/**
+ * @brief Adds a new entry, appending it to the index file first. If the blob is already known its location
+ * is reused, otherwise entry.location must say where it was stored.
+ * @return NAME_TAKEN if there already is an entry with that name, nothing is written in that case.
+ */
+MediaIndex::InsertResult MediaIndex::Insert(const MediaEntry &entry)
+{
+    std::unique_lock<std::shared_mutex> lock(m_mtx);
+
+    if (m_entries.count(entry.name) > 0)
+        return NAME_TAKEN;
+
+    Json::Value record = ToJson(entry);
+    record["op"] = "put";
+
+    // Known blob, its location is already in the table
+    if (m_blobs.count(entry.hash) > 0)
+    {
+        record.removeMember("segment");
+        record.removeMember("offset");
+    }
+
+    if (!Append(record))
+        return WRITE_ERROR;
+
+    Apply(record);
+
+    if (m_entries.size() > m_bloom.Capacity())
+        GrowBloom();
+    else
+        m_bloom.Add(entry.name);
+
+    return INSERTED;
+}
+
+/**
+ * @brief Looks a name up. Names not in the Bloom filter are rejected before touching the table.
+ * @return False if there is no entry with that name.
+ */
+bool MediaIndex::Find(const std::string &name, MediaEntry &entry) const
+{
+    std::shared_lock<std::shared_mutex> lock(m_mtx);
+
+    if (!m_bloom.MayContain(name))
+        return false;
+
+    auto it = m_entries.find(name);
+    if (it == m_entries.end())
+        return false;
+
+    entry = it->second;
+
+    auto blob = m_blobs.find(entry.hash);
+    if (blob != m_blobs.end())
+        entry.location = blob->second.location;
+
+    return true;
+}
+
+/**
+ * @brief Removes a name. The Bloom filter keeps the name, Find still checks the table after it.
+ * @param erased Filled with the removed entry, location included.
+ * @param lastReference Set if no other name uses the same blob anymore, so the blob itself can be deleted.
+ * @return False if the name does not exist or the record could not be written.
+ */
+bool MediaIndex::Erase(const std::string &name, MediaEntry &erased, bool &lastReference)
+{
+    std::unique_lock<std::shared_mutex> lock(m_mtx);
+
+    auto it = m_entries.find(name);
+    if (it == m_entries.end())
+        return false;
+
+    Json::Value record;
+    record["op"] = "del";
+    record["name"] = name;
+
+    if (!Append(record))
+        return false;
+
+    erased = it->second;
+    lastReference = false;
+
+    auto blob = m_blobs.find(erased.hash);
+    if (blob != m_blobs.end())
+    {
+        erased.location = blob->second.location;
+        lastReference = blob->second.references == 1;
+    }
+
+    Apply(record);
+    return true;
+}
+
+/*
+    Location of a blob by hash, false if no name uses it
+*/
+bool MediaIndex::FindBlob(const std::string &hash, BlobLocation &location) const
+{
+    std::shared_lock<std::shared_mutex> lock(m_mtx);
+
+    auto blob = m_blobs.find(hash);
+    if (blob == m_blobs.end())
+        return false;
+
+    location = blob->second.location;
+    return true;
+}
+
+/*
+    Records a new location for a blob, used by segment compaction
+*/
+MediaIndex::MoveResult MediaIndex::MoveBlob(const std::string &hash, const BlobLocation &location)
+{
+    std::unique_lock<std::shared_mutex> lock(m_mtx);
+
+    if (m_blobs.count(hash) == 0)
+        return BLOB_GONE;
+
+    Json::Value record;
+    record["op"] = "move";
+    record["hash"] = hash;
+    record["segment"] = Json::Int64(location.segment);
+    record["offset"] = Json::UInt64(location.offset);
+
+    if (!Append(record))
+        return MOVE_ERROR;
+
+    Apply(record);
+    return MOVED;
+}
+
+/*
+    Every live blob stored in a segment, with its location
+*/
+std::vector<std::pair<std::string, BlobLocation>> MediaIndex::SegmentBlobs() const
+{
+    std::shared_lock<std::shared_mutex> lock(m_mtx);
+
+    std::vector<std::pair<std::string, BlobLocation>> blobs;
+
+    for (auto &blob : m_blobs)
+    {
+        if (blob.second.location.segment >= 0)
+            blobs.emplace_back(blob.first, blob.second.location);
+    }
+    return blobs;
+}
+
+/*
+    Copy of every entry, for background work that must not hold the index lock while it runs
+*/
+std::vector<MediaEntry> MediaIndex::Snapshot() const
+{
+    std::shared_lock<std::shared_mutex> lock(m_mtx);
+
+    std::vector<MediaEntry> entries;
+    entries.reserve(m_entries.size());
+
+    for (auto &entry : m_entries)
+        entries.push_back(entry.second);
+
+    return entries;
+}
+
+size_t MediaIndex::Size() const
+{
+    std::shared_lock<std::shared_mutex> lock(m_mtx);
+    return m_entries.size();
+}
+
+Json::Value MediaIndex::ToJson(const MediaEntry &entry)
+{
+    Json::Value record;
+    record["name"] = entry.name;
+    record["hash"] = entry.hash;
+    record["filename"] = entry.filename;
+    record["ext"] = entry.ext;
+    record["uploader"] = entry.uploader;
+    record["size"] = Json::UInt64(entry.size);
+    record["time"] = Json::Int64(entry.timestamp);
+
+    if (entry.location.segment >= 0)
+    {
+        record["segment"] = Json::Int64(entry.location.segment);
+        record["offset"] = Json::UInt64(entry.location.offset);
+    }
+    return record;
+}
+
+MediaEntry MediaIndex::FromJson(const Json::Value &record)
+{
+    MediaEntry entry;
+    entry.name = record["name"].asString();
+    entry.hash = record.get("hash", "").asString();
+    entry.filename = record.get("filename", "").asString();
+    entry.ext = record.get("ext", "").asString();
+    entry.uploader = record.get("uploader", "").asString();
+    entry.size = record.get("size", 0).asUInt64();
+    entry.timestamp = record.get("time", 0).asInt64();
+    entry.location.segment = record.get("segment", -1).asInt64();
+    entry.location.offset = record.get("offset", 0).asUInt64();
+    entry.location.size = entry.size;
+    return entry;
+}
+
+/*
+    Flushes the appended records to disk. The descriptor is only set by Load, so no lock is needed
+*/
+bool MediaIndex::Sync()
+{
+    return m_fd >= 0 && fdatasync(m_fd) == 0;
+}
+
+/*
+    Appends one json line with a single write, O_APPEND keeps lines whole. Index lock must be held
+*/
+bool MediaIndex::Append(const Json::Value &record)
+{
+    if (m_fd < 0)
+        return false;
+
+    Json::StreamWriterBuilder builder;
+    builder["indentation"] = "";
+    std::string line = Json::writeString(builder, record) + "\n";
+
+    return write(m_fd, line.data(), line.size()) == (ssize_t)line.size();
+}
+
+/*
+    Rebuilds the filter with twice the capacity once it is full, so the false positive rate stays low. Index lock must be held
+*/
+void MediaIndex::GrowBloom()
+{
+    m_bloom = BloomFilter(m_bloom.Capacity() * 2);
+
+    for (auto &entry : m_entries)
+        m_bloom.Add(entry.first);
+}
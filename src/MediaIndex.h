@@ -0,0 +1,148 @@
+/*
+ *   @author jozese
+ *
+ *
+ *
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <jsoncpp/json/json.h>
+
+/**
+ * @struct BlobLocation
+ * @brief Where the content of a blob lives: its own file (segment -1) or a range of a segment file.
+ */
+struct BlobLocation
+{
+    int64_t segment = -1;
+    uint64_t offset = 0;
+    uint64_t size = 0;
+};
+
+/**
+ * @struct MediaEntry
+ * @brief Everything the server knows about a stored file, keyed by its user visible name.
+ */
+struct MediaEntry
+{
+    std::string name;
+
+    // Empty for files stored before the content addressed store, those are served from <root>/<name>.json
+    std::string hash;
+
+    std::string filename;
+    std::string ext;
+    std::string uploader;
+    uint64_t size = 0;
+    std::time_t timestamp = 0;
+
+    // Filled by Find from the blob table, every name with the same hash shares it
+    BlobLocation location;
+};
+
+/**
+ * @class BloomFilter
+ * @brief Fixed size Bloom filter over strings, about 1% false positives at capacity.
+ */
+class BloomFilter
+{
+public:
+    BloomFilter(size_t capacity);
+
+    void Add(const std::string &key);
+    bool MayContain(const std::string &key) const;
+
+    inline size_t Capacity() const
+    {
+        return m_capacity;
+    }
+
+private:
+    static constexpr int HASHES = 7;
+
+    std::vector<uint64_t> m_bits;
+    size_t m_capacity = 0;
+};
+
+/**
+ * @class MediaIndex
+ * @brief Persistent index of stored media.
+ *
+ * Records are appended as json lines to an index file and replayed at startup into a hash table.
+ * A Bloom filter sits in front of the table so names that were never stored are rejected without
+ * touching the filesystem or the table.
+ *
+ * Besides names, the index keeps a blob table (hash -> location and number of names using it).
+ * Records are "put" (new name), "move" (blob relocated by compaction) and "del" (name removed).
+ */
+class MediaIndex
+{
+public:
+    enum InsertResult
+    {
+        INSERTED,
+        NAME_TAKEN,
+        WRITE_ERROR,
+    };
+
+    enum MoveResult
+    {
+        MOVED,
+        BLOB_GONE,
+        MOVE_ERROR,
+    };
+
+    MediaIndex(const std::string &path);
+    ~MediaIndex();
+
+    MediaIndex(const MediaIndex &) = delete;
+    MediaIndex &operator=(const MediaIndex &) = delete;
+
+public:
+    bool Load();
+
+    InsertResult Insert(const MediaEntry &entry);
+    bool Find(const std::string &name, MediaEntry &entry) const;
+    bool Erase(const std::string &name, MediaEntry &erased, bool &lastReference);
+
+    bool FindBlob(const std::string &hash, BlobLocation &location) const;
+    MoveResult MoveBlob(const std::string &hash, const BlobLocation &location);
+    std::vector<std::pair<std::string, BlobLocation>> SegmentBlobs() const;
+
+    std::vector<MediaEntry> Snapshot() const;
+    size_t Size() const;
+
+    bool Sync();
+
+private:
+    struct Blob
+    {
+        BlobLocation location;
+        uint64_t references = 0;
+    };
+
+    static Json::Value ToJson(const MediaEntry &entry);
+    static MediaEntry FromJson(const Json::Value &record);
+
+    void Apply(const Json::Value &record);
+
+    bool Append(const Json::Value &record);
+    void GrowBloom();
+
+private:
+    std::string m_path = "";
+    int m_fd = -1;
+
+    mutable std::shared_mutex m_mtx;
+    std::unordered_map<std::string, MediaEntry> m_entries;
+    std::unordered_map<std::string, Blob> m_blobs;
+    BloomFilter m_bloom{1024};
+};
@@ -0,0 +1,459 @@
+#include "MediaStore.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <openssl/evp.h>
+
+MediaStore::MediaStore(const std::string &root) : m_root(root), m_index(root + "/index.log"), m_segments(root + "/segments")
+{
+    std::filesystem::create_directories(m_root + "/blobs");
+
+    bool hasIndex = std::filesystem::exists(m_root + "/index.log");
+
+    if (!m_index.Load())
+        std::cerr << "Error opening media index" << std::endl;
+
+    if (!hasIndex)
+        Import();
+}
+
+/**
+ * @brief Stores an upload. The content is only written if no blob with the same hash exists yet.
+ * @param filename Filename given by the client.
+ * @param ext Extension given by the client.
+ * @param content File content, as sent by the client (base64).
+ * @param timestamp Upload time, used to build the user visible name.
+ * @param uploader Username of the uploader.
+ * @return The user visible name (<timestamp>_<filename>), or an empty string on error.
+ */
+std::string MediaStore::Store(const std::string &filename, const std::string &ext, const std::string &content, std::time_t timestamp, const std::string &uploader)
+{
+    MediaEntry entry;
+    entry.hash = Hash(content);
+
+    if (entry.hash.empty() || !IsValidUploadName(filename, timestamp))
+        return "";
+
+    std::unique_lock<std::mutex> segmentLock(m_segmentWriteMtx, std::defer_lock);
+    std::unique_lock<std::mutex> blobLock(m_blobMtx, std::defer_lock);
+
+    // Remove cannot unlink a blob file between finding it here and indexing the new name
+    if (content.size() > SEGMENT_BLOB_MAX)
+        blobLock.lock();
+
+    if (!m_index.FindBlob(entry.hash, entry.location))
+    {
+        if (content.size() <= SEGMENT_BLOB_MAX)
+        {
+            segmentLock.lock();
+
+            if (!m_index.FindBlob(entry.hash, entry.location) && !m_segments.Append(content, entry.location))
+                return "";
+        }
+        else if (!WriteBlob(entry.hash, content))
+        {
+            return "";
+        }
+    }
+
+    entry.filename = filename;
+    entry.ext = ext;
+    entry.uploader = uploader;
+    entry.size = content.size();
+    entry.timestamp = timestamp;
+    entry.name = std::to_string(timestamp) + "_" + filename;
+
+    // Two uploads with the same filename in the same second get different names instead of overwriting each other
+    for (int i = 1;; i++)
+    {
+        MediaIndex::InsertResult result = m_index.Insert(entry);
+
+        // The name is only handed out once its record is durable, other uploads need not wait for that flush
+        if (result == MediaIndex::INSERTED)
+        {
+            if (segmentLock.owns_lock())
+                segmentLock.unlock();
+            if (blobLock.owns_lock())
+                blobLock.unlock();
+
+            return m_commit.Commit() ? entry.name : "";
+        }
+
+        if (result == MediaIndex::WRITE_ERROR || i > MEDIA_NAME_RETRIES)
+            return "";
+
+        entry.name = std::to_string(timestamp) + "_" + std::to_string(i) + "_" + filename;
+    }
+}
+
+/**
+ * @brief Opens a file by its user visible name, as the json payload the client uploaded.
+ * The name is looked up in the media index first, unknown names never touch the filesystem.
+ * Files stored before the content addressed store are still served from <root>/<name>.json
+ * @param name User visible name.
+ * @return The file, nullptr if it does not exist.
+ */
+std::shared_ptr<const MediaFile> MediaStore::Open(const std::string &name)
+{
+    MediaEntry entry;
+    auto file = std::make_shared<MediaFile>();
+
+    if (!IsValidName(name))
+        return nullptr;
+
+    // Compaction can delete a segment between the lookup and the mapping, the second lookup gets the new location
+    for (int attempt = 0; attempt < 2 && !file->mapping; attempt++)
+    {
+        if (!m_index.Find(name, entry))
+            return nullptr;
+
+        if (entry.hash.empty())
+            file->mapping = Map(m_root + "/" + name + ".json");
+        else if (entry.location.segment < 0)
+            file->mapping = Map(BlobPath(entry.hash));
+        else
+            file->mapping = m_segments.Map(entry.location.segment, entry.location.offset + entry.location.size);
+    }
+
+    if (!file->mapping)
+        return nullptr;
+
+    if (entry.location.segment < 0)
+        file->content = std::string_view(reinterpret_cast<const char *>(file->mapping->Data()), file->mapping->Size());
+    else
+        file->content = std::string_view(reinterpret_cast<const char *>(file->mapping->Data()) + entry.location.offset, entry.location.size);
+
+    if (entry.hash.empty())
+        return file;
+
+    file->prefix = R"({"filename":)" + Json::valueToQuotedString(entry.filename.c_str()) +
+                   R"(,"ext":)" + Json::valueToQuotedString(entry.ext.c_str()) + R"(,"content":")";
+    file->suffix = R"("})";
+
+    return file;
+}
+
+/**
+ * @brief Removes a name. Once no name uses its blob anymore, a blob file is deleted right away and a
+ * segment blob becomes dead space that Compact reclaims.
+ * @return False if the name does not exist.
+ */
+bool MediaStore::Remove(const std::string &name)
+{
+    MediaEntry erased;
+    bool lastReference = false;
+
+    if (!m_index.Erase(name, erased, lastReference))
+        return false;
+
+    // The blob is only deleted once no durable record points to it anymore
+    if (!m_commit.Commit())
+        return true;
+
+    if (erased.hash.empty())
+    {
+        unlink((m_root + "/" + name + ".json").c_str());
+    }
+    else if (lastReference && erased.location.segment < 0)
+    {
+        std::lock_guard<std::mutex> lock(m_blobMtx);
+        BlobLocation location;
+
+        // A Store of the same content may have indexed it again since the erase
+        if (!m_index.FindBlob(erased.hash, location))
+            unlink(BlobPath(erased.hash).c_str());
+    }
+
+    return true;
+}
+
+/**
+ * @brief Compacts segments that are at least half dead: their live blobs are appended to the active
+ * segment, moved in the index and the old segment is deleted. Meant to run in the background.
+ * @return Bytes reclaimed.
+ */
+uint64_t MediaStore::Compact()
+{
+    // Read first: only the active segment takes appends, so every segment before it is sealed and fully in the blob snapshot.
+    // Segments from it on may have been rolled meanwhile and are left alone
+    int64_t active = m_segments.ActiveSegment();
+    auto blobs = m_index.SegmentBlobs();
+    auto segments = m_segments.Segments();
+
+    std::map<int64_t, uint64_t> live;
+    for (auto &blob : blobs)
+        live[blob.second.segment] += blob.second.size;
+
+    uint64_t reclaimed = 0;
+
+    for (auto &segment : segments)
+    {
+        if (segment.first >= active || segment.second == 0 || live[segment.first] * 2 > segment.second)
+            continue;
+
+        auto mapping = m_segments.Map(segment.first, segment.second);
+
+        if (!mapping && live[segment.first] > 0)
+            continue;
+
+        bool failed = false;
+
+        for (auto &blob : blobs)
+        {
+            if (blob.second.segment != segment.first)
+                continue;
+
+            BlobLocation moved;
+            std::string_view content(reinterpret_cast<const char *>(mapping->Data()) + blob.second.offset, blob.second.size);
+
+            std::lock_guard<std::mutex> lock(m_segmentWriteMtx);
+
+            // If the blob was removed meanwhile the copy is just dead space in the active segment
+            if (!m_segments.Append(content, moved) || m_index.MoveBlob(blob.first, moved) == MediaIndex::MOVE_ERROR)
+            {
+                failed = true;
+                break;
+            }
+        }
+
+        // Moves must be durable before the old copy is gone, and a blob that was not moved is still read from it
+        if (!m_commit.Commit() || failed)
+            continue;
+
+        // Readers that still hold the old mapping keep it alive until they are done
+        m_segments.Remove(segment.first);
+        reclaimed += segment.second - live[segment.first];
+    }
+
+    return reclaimed;
+}
+
+/**
+ * @brief Removes the files that break the retention policy, oldest first, working off a snapshot of the
+ * index. A file goes if it is too old, its uploader is over quota or the store is over its byte budget.
+ * Meant to run in the background.
+ * @param now Current time, files are aged against it.
+ * @return Names removed, so caches holding them can drop them.
+ */
+std::vector<std::string> MediaStore::Sweep(const RetentionPolicy &policy, std::time_t now)
+{
+    std::vector<std::string> removed;
+
+    if (policy.maxAge == 0 && policy.maxBytes == 0 && policy.userQuota == 0)
+        return removed;
+
+    auto entries = m_index.Snapshot();
+
+    std::sort(entries.begin(), entries.end(), [](const MediaEntry &a, const MediaEntry &b)
+              { return a.timestamp < b.timestamp; });
+
+    uint64_t total = 0;
+    std::unordered_map<std::string, uint64_t> perUser;
+
+    for (auto &entry : entries)
+    {
+        total += entry.size;
+        if (!entry.uploader.empty())
+            perUser[entry.uploader] += entry.size;
+    }
+
+    // Oldest first, so whichever limit is broken, the oldest files are the ones that go
+    for (auto &entry : entries)
+    {
+        bool expired = policy.maxAge > 0 && entry.timestamp + policy.maxAge < now;
+        bool overQuota = policy.userQuota > 0 && !entry.uploader.empty() && perUser[entry.uploader] > policy.userQuota;
+        bool overBudget = policy.maxBytes > 0 && total > policy.maxBytes;
+
+        if (!expired && !overQuota && !overBudget)
+            continue;
+
+        if (!Remove(entry.name))
+            continue;
+
+        total -= entry.size;
+        if (!entry.uploader.empty())
+            perUser[entry.uploader] -= entry.size;
+
+        removed.push_back(entry.name);
+    }
+
+    return removed;
+}
+
+/*
+    First start with a media index: adds the files stored before it existed, name records from <root>/names
+    and whole payloads stored as <root>/<name>.json. Runs once, at startup.
+*/
+void MediaStore::Import()
+{
+    namespace fs = std::filesystem;
+    std::error_code ec;
+
+    Json::CharReaderBuilder builder;
+
+    for (auto &dirEntry : fs::directory_iterator(m_root + "/names", ec))
+    {
+        if (dirEntry.path().extension() != ".json")
+            continue;
+
+        std::ifstream recordFile(dirEntry.path());
+        Json::Value record;
+
+        if (!Json::parseFromStream(builder, recordFile, &record, nullptr) || !record["hash"].isString())
+            continue;
+
+        MediaEntry entry;
+        entry.name = dirEntry.path().stem().string();
+        entry.hash = record["hash"].asString();
+        entry.filename = record.get("filename", "").asString();
+        entry.ext = record.get("ext", "").asString();
+        entry.size = record.get("size", 0).asUInt64();
+        entry.timestamp = std::atoll(entry.name.c_str());
+        m_index.Insert(entry);
+    }
+
+    for (auto &dirEntry : fs::directory_iterator(m_root, ec))
+    {
+        if (!dirEntry.is_regular_file() || dirEntry.path().extension() != ".json")
+            continue;
+
+        MediaEntry entry;
+        entry.name = dirEntry.path().stem().string();
+        entry.size = dirEntry.file_size();
+        entry.timestamp = std::atoll(entry.name.c_str());
+        m_index.Insert(entry);
+    }
+}
+
+/*
+    Returns the live mapping of a path if there is one, otherwise maps it.
+    Blobs are never modified once renamed into place, so a mapping stays valid for its whole life.
+*/
+std::shared_ptr<const File::MappedFile> MediaStore::Map(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(m_mapsMtx);
+
+    auto it = m_maps.find(path);
+    if (it != m_maps.end())
+    {
+        if (auto mapping = it->second.lock())
+            return mapping;
+    }
+
+    auto mapping = File::MappedFile::Open(path);
+
+    if (mapping)
+        m_maps[path] = mapping;
+    else if (it != m_maps.end())
+        m_maps.erase(it);
+
+    // Drops entries whose mapping is gone so the table does not grow with every file ever served
+    if (m_maps.size() > 1024)
+        std::erase_if(m_maps, [](const auto &entry) { return entry.second.expired(); });
+
+    return mapping;
+}
+
+/*
+    Names end up in paths, so anything that could escape the store directory is rejected
+*/
+bool MediaStore::IsValidName(const std::string &name)
+{
+    if (name.empty() || name.length() > MEDIA_NAME_MAX || name == "." || name == "..")
+        return false;
+
+    return name.find('/') == std::string::npos && name.find('\0') == std::string::npos;
+}
+
+/*
+    The stored name is <timestamp>_[<n>_]<filename>, so the filename only gets what the longest prefix leaves
+*/
+bool MediaStore::IsValidUploadName(const std::string &filename, std::time_t timestamp)
+{
+    size_t prefix = std::to_string(timestamp).length() + 1 + std::to_string(MEDIA_NAME_RETRIES).length() + 1;
+    return IsValidName(filename) && filename.length() + prefix <= MEDIA_NAME_MAX;
+}
+
+/**
+ * @brief SHA-256 of the content, fed to the digest in chunks.
+ * @return Hex digest, empty on error.
+ */
+std::string MediaStore::Hash(const std::string &content)
+{
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digestLength = 0;
+
+    if (ctx == nullptr)
+        return "";
+
+    bool ok = EVP_DigestInit_ex(ctx, EVP_sha256(), nullptr) == 1;
+
+    const size_t chunk = 64 * 1024;
+    for (size_t offset = 0; ok && offset < content.size(); offset += chunk)
+        ok = EVP_DigestUpdate(ctx, content.data() + offset, std::min(chunk, content.size() - offset)) == 1;
+
+    ok = ok && EVP_DigestFinal_ex(ctx, digest, &digestLength) == 1;
+    EVP_MD_CTX_free(ctx);
+
+    if (!ok)
+        return "";
+
+    std::stringstream ss;
+    for (unsigned int i = 0; i < digestLength; i++)
+        ss << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(digest[i]);
+
+    return ss.str();
+}
+
+std::string MediaStore::BlobPath(const std::string &hash) const
+{
+    return m_root + "/blobs/" + hash;
+}
+
+/*
+    Writes the blob to a temporary file and renames it, so a blob is either complete or missing.
+    If the blob already exists nothing is written. Blobs of at least the direct I/O threshold skip the page cache.
+*/
+bool MediaStore::WriteBlob(const std::string &hash, const std::string &content)
+{
+    std::string path = BlobPath(hash);
+
+    if (access(path.c_str(), F_OK) == 0)
+        return true;
+
+    std::string tmpPath = path + ".tmp." + std::to_string(gettid());
+
+    uint64_t directMin = m_directMin.load(std::memory_order_relaxed);
+    bool direct = directMin > 0 && content.size() >= directMin;
+
+    // The index record is flushed by group commit, the blob it points to has to be on disk before it
+    bool sync = m_commit.GetDurability() != Durability::NONE;
+
+    if (!File::PreallocatedWrite(content.data(), content.size(), tmpPath, direct, sync))
+    {
+        unlink(tmpPath.c_str());
+        return false;
+    }
+
+    if (rename(tmpPath.c_str(), path.c_str()) != 0)
+    {
+        unlink(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+/*
+    Group commit flush: segment data first, then the index records pointing to it
+*/
+bool MediaStore::Flush()
+{
+    return m_segments.Sync() && m_index.Sync();
+}
@@ -0,0 +1,137 @@
+/*
+ *   @author jozese
+ *
+ *
+ *
+ */
+
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <string_view>
+#include <unordered_map>
+
+#include <jsoncpp/json/json.h>
+
+#include "Utils.h"
+#include "MediaIndex.h"
+#include "SegmentStore.h"
+#include "GroupCommit.h"
+
+// Longest user visible name, it is also a filename for files stored before the content addressed store
+#define MEDIA_NAME_MAX 255
+
+// Uploads with the same filename in the same second that still get a name of their own
+#define MEDIA_NAME_RETRIES 100
+
+/**
+ * @struct MediaFile
+ * @brief A stored file ready to be sent as the payload of ACK_MEDIA_DOWNLOAD: prefix + content + suffix.
+ * The content points into a shared mapping (the blob file or its range of a segment), it is never copied.
+ */
+struct MediaFile
+{
+    std::string prefix;
+    std::shared_ptr<const File::MappedFile> mapping;
+    std::string_view content;
+    std::string suffix;
+
+    inline size_t Size() const
+    {
+        return prefix.size() + content.size() + suffix.size();
+    }
+};
+
+/**
+ * @struct RetentionPolicy
+ * @brief Limits enforced by MediaStore::Sweep, 0 means no limit. Sizes are what was uploaded, a blob
+ * shared by several names is counted once per name.
+ */
+struct RetentionPolicy
+{
+    // Seconds a file is kept after its upload
+    std::time_t maxAge = 0;
+
+    // Total bytes of all stored files
+    uint64_t maxBytes = 0;
+
+    // Bytes stored per uploader, files stored before uploaders were recorded are not counted
+    uint64_t userQuota = 0;
+};
+
+/**
+ * @class MediaStore
+ * @brief Content addressed storage for uploaded media.
+ *
+ * Every upload is hashed (SHA-256) and its content is stored once: small blobs are packed into
+ * segment files under <root>/segments, bigger ones get their own file under <root>/blobs/<hash>.
+ * Each user visible name gets a record in the media index pointing to the blob, so posting
+ * the same file again only costs appending that record.
+ */
+class MediaStore
+{
+public:
+    MediaStore(const std::string &root);
+
+public:
+    std::string Store(const std::string &filename, const std::string &ext, const std::string &content, std::time_t timestamp, const std::string &uploader);
+    std::shared_ptr<const MediaFile> Open(const std::string &name);
+    bool Remove(const std::string &name);
+    uint64_t Compact();
+    std::vector<std::string> Sweep(const RetentionPolicy &policy, std::time_t now);
+
+    inline void SetDurability(Durability durability)
+    {
+        m_commit.SetDurability(durability);
+    }
+
+    // Blobs of at least this many bytes are written with O_DIRECT, 0 disables it
+    inline void SetDirectIo(uint64_t minBytes)
+    {
+        m_directMin.store(minBytes, std::memory_order_relaxed);
+    }
+
+    inline MediaIndex &GetIndex()
+    {
+        return m_index;
+    }
+
+    static bool IsValidName(const std::string &name);
+    static bool IsValidUploadName(const std::string &filename, std::time_t timestamp);
+    static std::string Hash(const std::string &content);
+
+private:
+    std::string BlobPath(const std::string &hash) const;
+
+    bool WriteBlob(const std::string &hash, const std::string &content);
+    bool Flush();
+    void Import();
+
+    std::shared_ptr<const File::MappedFile> Map(const std::string &path);
+
+private:
+    std::string m_root = "";
+    MediaIndex m_index;
+    SegmentStore m_segments;
+
+    // Held from checking if a small blob exists until its name is indexed, so it is never appended twice
+    std::mutex m_segmentWriteMtx;
+
+    // Held from checking if a blob file exists until its name is indexed, and by Remove before unlinking one
+    std::mutex m_blobMtx;
+
+    std::atomic<uint64_t> m_directMin{0};
+
+    // Live mappings by path, so concurrent downloads of the same file share one mapping
+    std::unordered_map<std::string, std::weak_ptr<const File::MappedFile>> m_maps;
+    std::mutex m_mapsMtx;
+
+    // Flushes segment and index appends, last so its thread stops before the rest is torn down
+    GroupCommit m_commit{[this] { return Flush(); }};
+};
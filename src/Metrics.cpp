@@ -0,0 +1,326 @@
+#include "Metrics.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "PigeonPacket.h"
+
+void MetricsHistogram::Record(uint64_t value)
+{
+    buckets[Bucket(value)].fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(value, std::memory_order_relaxed);
+
+    uint64_t current = max.load(std::memory_order_relaxed);
+    while (value > current && !max.compare_exchange_weak(current, value, std::memory_order_relaxed))
+    {
+    }
+}
+
+size_t MetricsHistogram::Bucket(uint64_t value)
+{
+    constexpr uint64_t sub = 1 << METRICS_SUB_BITS;
+
+    if (value < sub)
+        return value;
+
+    int exponent = 63 - __builtin_clzll(value);
+    if (exponent > METRICS_MAX_EXPONENT)
+        return METRICS_BUCKETS - 1;
+
+    size_t offset = (value >> (exponent - METRICS_SUB_BITS)) & (sub - 1);
+    return ((exponent - METRICS_SUB_BITS + 1) << METRICS_SUB_BITS) + offset;
+}
+
+uint64_t MetricsHistogram::UpperBound(size_t bucket)
+{
+    constexpr uint64_t sub = 1 << METRICS_SUB_BITS;
+
+    if (bucket < sub)
+        return bucket + 1;
+
+    int exponent = (bucket >> METRICS_SUB_BITS) + METRICS_SUB_BITS - 1;
+    uint64_t offset = bucket & (sub - 1);
+    return (sub + offset + 1) << (exponent - METRICS_SUB_BITS);
+}
+
+/*
+    Upper bound of the bucket holding the q quantile, capped to the largest value seen
+*/
+uint64_t HistogramSnapshot::Percentile(double q) const
+{
+    if (count == 0)
+        return 0;
+
+    uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(q * count + 0.5));
+    uint64_t seen = 0;
+
+    for (size_t i = 0; i < buckets.size(); i++)
+    {
+        seen += buckets[i];
+        if (seen >= rank)
+            return std::min(MetricsHistogram::UpperBound(i), max);
+    }
+
+    return max;
+}
+
+Metrics &Metrics::Get()
+{
+    static Metrics metrics;
+    return metrics;
+}
+
+Metrics::LocalShard::~LocalShard()
+{
+    if (shard != nullptr)
+        Metrics::Get().Release(shard);
+}
+
+Metrics::Shard &Metrics::Local()
+{
+    static thread_local LocalShard local;
+
+    if (local.shard == nullptr)
+        local.shard = Acquire();
+
+    return *local.shard;
+}
+
+/*
+    Reuses the shard of a thread that exited, or publishes a new one. Past METRICS_MAX_SHARDS every new thread gets the last shard,
+    which is fine since every update is atomic.
+*/
+Metrics::Shard *Metrics::Acquire()
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+
+    if (!m_free.empty())
+    {
+        Shard *shard = m_free.back();
+        m_free.pop_back();
+        return shard;
+    }
+
+    size_t count = m_shardCount.load(std::memory_order_relaxed);
+    if (count == METRICS_MAX_SHARDS)
+        return m_shards[METRICS_MAX_SHARDS - 1].load(std::memory_order_relaxed);
+
+    Shard *shard = new Shard();
+    m_shards[count].store(shard, std::memory_order_release);
+    m_shardCount.store(count + 1, std::memory_order_release);
+
+    return shard;
+}
+
+/*
+    The shared last shard never goes to the free list, it would end up with a single owner while others still write to it
+*/
+void Metrics::Release(Shard *shard)
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+
+    if (shard != m_shards[METRICS_MAX_SHARDS - 1].load(std::memory_order_relaxed))
+        m_free.push_back(shard);
+}
+
+void Metrics::Add(MetricCounter counter, uint64_t n)
+{
+    Local().counters[static_cast<size_t>(counter)].fetch_add(n, std::memory_order_relaxed);
+}
+
+void Metrics::AddPacket(uint8_t opcode, uint64_t bytes)
+{
+    Shard &shard = Local();
+
+    shard.counters[static_cast<size_t>(MetricCounter::PACKETS_IN)].fetch_add(1, std::memory_order_relaxed);
+    shard.counters[static_cast<size_t>(MetricCounter::BYTES_IN)].fetch_add(bytes, std::memory_order_relaxed);
+    shard.opcodePackets[opcode].fetch_add(1, std::memory_order_relaxed);
+    shard.opcodeBytes[opcode].fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void Metrics::Record(uint8_t opcode, MetricStage stage, uint64_t ns)
+{
+    auto &slot = Local().histograms[opcode * static_cast<size_t>(MetricStage::COUNT) + static_cast<size_t>(stage)];
+
+    MetricsHistogram *histogram = slot.load(std::memory_order_acquire);
+    if (histogram == nullptr)
+    {
+        // Only the shared last shard can race here, the loser frees its copy
+        MetricsHistogram *fresh = new MetricsHistogram();
+        if (slot.compare_exchange_strong(histogram, fresh, std::memory_order_acq_rel))
+            histogram = fresh;
+        else
+            delete fresh;
+    }
+
+    histogram->Record(ns);
+}
+
+/**
+ * @brief Registers a value owned by another component. The callback is called from whatever thread collects,
+ * so it must be thread safe and must not block.
+ */
+void Metrics::Watch(const std::string &name, const std::string &help, MetricKind kind, std::function<double()> read)
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_watched.push_back(Watched{name, help, kind, std::move(read)});
+}
+
+std::vector<Metrics::Watched> Metrics::GetWatched() const
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+    return m_watched;
+}
+
+/*
+    Sums every published shard. Shards are read with relaxed loads while their threads keep writing.
+*/
+MetricsSnapshot Metrics::Collect() const
+{
+    MetricsSnapshot snapshot;
+    size_t count = m_shardCount.load(std::memory_order_acquire);
+
+    for (size_t s = 0; s < count; s++)
+    {
+        const Shard *shard = m_shards[s].load(std::memory_order_acquire);
+
+        for (size_t i = 0; i < snapshot.counters.size(); i++)
+            snapshot.counters[i] += shard->counters[i].load(std::memory_order_relaxed);
+
+        for (size_t op = 0; op < 256; op++)
+        {
+            snapshot.opcodePackets[op] += shard->opcodePackets[op].load(std::memory_order_relaxed);
+            snapshot.opcodeBytes[op] += shard->opcodeBytes[op].load(std::memory_order_relaxed);
+        }
+
+        for (size_t key = 0; key < shard->histograms.size(); key++)
+        {
+            const MetricsHistogram *histogram = shard->histograms[key].load(std::memory_order_acquire);
+            if (histogram == nullptr)
+                continue;
+
+            HistogramSnapshot &merged = snapshot.histograms[key];
+            for (size_t b = 0; b < METRICS_BUCKETS; b++)
+            {
+                uint64_t n = histogram->buckets[b].load(std::memory_order_relaxed);
+                merged.buckets[b] += n;
+                merged.count += n;
+            }
+
+            merged.sum += histogram->sum.load(std::memory_order_relaxed);
+            merged.max = std::max(merged.max, histogram->max.load(std::memory_order_relaxed));
+        }
+    }
+
+    return snapshot;
+}
+
+const char *Metrics::StageName(MetricStage stage)
+{
+    static const char *names[] = {"read", "decode", "process", "send", "total"};
+    return names[static_cast<size_t>(stage)];
+}
+
+/*
+    Name of the opcode, unknown opcodes as hex so each one stays apart
+*/
+std::string Metrics::OpcodeLabel(int opcode)
+{
+    const char *name = OpcodeName(opcode);
+    if (std::strcmp(name, "UNKNOWN") != 0)
+        return name;
+
+    char hex[8];
+    std::snprintf(hex, sizeof(hex), "0x%02X", opcode);
+    return hex;
+}
+
+/**
+ * @brief Human readable summary, one line for the totals, one per watched value and one per opcode seen
+ * with the p50/p99/max of every stage in microseconds.
+ */
+std::vector<std::string> Metrics::Report() const
+{
+    MetricsSnapshot snapshot = Collect();
+    std::vector<std::string> lines;
+    char line[512];
+
+    std::snprintf(line, sizeof(line), "METRICS: %llu PKTS IN, %llu BYTES IN, %llu WRITES OUT, %llu BYTES OUT, %llu CONNECTIONS",
+                  static_cast<unsigned long long>(snapshot.Get(MetricCounter::PACKETS_IN)), static_cast<unsigned long long>(snapshot.Get(MetricCounter::BYTES_IN)),
+                  static_cast<unsigned long long>(snapshot.Get(MetricCounter::WRITES_OUT)), static_cast<unsigned long long>(snapshot.Get(MetricCounter::BYTES_OUT)),
+                  static_cast<unsigned long long>(snapshot.Get(MetricCounter::CONNECTIONS)));
+    lines.push_back(line);
+
+    for (auto &watched : GetWatched())
+    {
+        std::snprintf(line, sizeof(line), "METRICS: %s %.0f", watched.name.c_str(), watched.read());
+        lines.push_back(line);
+    }
+
+    constexpr size_t stages = static_cast<size_t>(MetricStage::COUNT);
+
+    for (int op = 0; op < 256; op++)
+    {
+        if (snapshot.opcodePackets[op] == 0)
+            continue;
+
+        std::string text = "METRICS: " + OpcodeLabel(op) + " " + std::to_string(snapshot.opcodePackets[op]) + " PKTS";
+
+        for (size_t stage = 0; stage < stages; stage++)
+        {
+            auto it = snapshot.histograms.find(op * stages + stage);
+            if (it == snapshot.histograms.end())
+                continue;
+
+            std::snprintf(line, sizeof(line), " %s %.1f/%.1f/%.1f", StageName(static_cast<MetricStage>(stage)), it->second.Percentile(0.5) / 1e3,
+                          it->second.Percentile(0.99) / 1e3, it->second.max / 1e3);
+            text += line;
+        }
+
+        lines.push_back(text + " (p50/p99/max us)");
+    }
+
+    return lines;
+}
+
+PacketTimer::PacketTimer(uint64_t started) : m_started(started), m_last(Metrics::Now())
+{
+    if (m_started == 0)
+        m_started = m_last;
+
+    m_stages[static_cast<size_t>(MetricStage::READ)] = m_last - m_started;
+}
+
+PacketTimer::~PacketTimer()
+{
+    if (m_opcode < 0)
+        return;
+
+    Mark(MetricStage::SEND);
+    m_stages[static_cast<size_t>(MetricStage::TOTAL)] = m_last - m_started;
+
+    Metrics &metrics = Metrics::Get();
+    for (size_t stage = 0; stage < m_stages.size(); stage++)
+        metrics.Record(m_opcode, static_cast<MetricStage>(stage), m_stages[stage]);
+}
+
+/*
+    Counts the packet and ends the DECODE stage
+*/
+void PacketTimer::Decoded(uint8_t opcode, uint64_t bytes)
+{
+    m_opcode = opcode;
+    Metrics::Get().AddPacket(opcode, bytes);
+    Mark(MetricStage::DECODE);
+}
+
+/*
+    Ends a stage, its time is what passed since the previous one ended
+*/
+void PacketTimer::Mark(MetricStage stage)
+{
+    uint64_t now = Metrics::Now();
+    m_stages[static_cast<size_t>(stage)] = now - m_last;
+    m_last = now;
+}
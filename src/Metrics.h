@@ -0,0 +1,213 @@
+/*
+ *   @author jozese
+ *
+ *
+ *
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Sub-buckets per power of two, 3 bits keeps every bucket within 12.5% of the values it holds
+#define METRICS_SUB_BITS 3
+
+// Latencies are in ns, anything over 2^40 ns (about 18 minutes) lands in the last bucket
+#define METRICS_MAX_EXPONENT 40
+
+#define METRICS_BUCKETS (((METRICS_MAX_EXPONENT - METRICS_SUB_BITS + 1) << METRICS_SUB_BITS) + (1 << METRICS_SUB_BITS))
+
+// Threads beyond this share the last shard
+#ifndef METRICS_MAX_SHARDS
+#define METRICS_MAX_SHARDS 4096
+#endif
+
+enum class MetricCounter
+{
+    PACKETS_IN,
+    BYTES_IN,
+    // Calls to SendAll, a media download is several of them
+    WRITES_OUT,
+    BYTES_OUT,
+    CONNECTIONS,
+    COUNT,
+};
+
+/*
+    Stages of a packet in a client thread:
+    READ from its first header bytes until the whole frame is read, DECODE, PROCESS, SEND until the last write,
+    TOTAL from the first header bytes until the last write
+*/
+enum class MetricStage
+{
+    READ,
+    DECODE,
+    PROCESS,
+    SEND,
+    TOTAL,
+    COUNT,
+};
+
+enum class MetricKind
+{
+    COUNTER,
+    GAUGE,
+};
+
+/**
+ * @struct MetricsHistogram
+ * @brief Log-linear histogram in the spirit of HdrHistogram. Values below 2^METRICS_SUB_BITS get a bucket each,
+ *        every power of two above is split in 2^METRICS_SUB_BITS buckets.
+ */
+struct MetricsHistogram
+{
+    std::array<std::atomic<uint64_t>, METRICS_BUCKETS> buckets{};
+    std::atomic<uint64_t> sum{0};
+    std::atomic<uint64_t> max{0};
+
+    void Record(uint64_t value);
+
+    static size_t Bucket(uint64_t value);
+    // Smallest value that does not fit in the bucket
+    static uint64_t UpperBound(size_t bucket);
+};
+
+struct HistogramSnapshot
+{
+    std::array<uint64_t, METRICS_BUCKETS> buckets{};
+    // Sum of the buckets, so it always agrees with them
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint64_t max = 0;
+
+    uint64_t Percentile(double q) const;
+};
+
+struct MetricsSnapshot
+{
+    std::array<uint64_t, static_cast<size_t>(MetricCounter::COUNT)> counters{};
+    std::array<uint64_t, 256> opcodePackets{};
+    std::array<uint64_t, 256> opcodeBytes{};
+
+    // Keyed by opcode * MetricStage::COUNT + stage, only opcodes that were seen
+    std::map<int, HistogramSnapshot> histograms;
+
+    inline uint64_t Get(MetricCounter counter) const
+    {
+        return counters[static_cast<size_t>(counter)];
+    }
+};
+
+/**
+ * @class Metrics
+ * @brief Process wide registry of counters, gauges and per opcode latency histograms.
+ *
+ * Every thread writes to its own shard, so recording is a few uncontended atomic adds and never takes a lock.
+ * Shards are published in a fixed array and are never freed: a thread that exits hands its shard to the next
+ * thread, which keeps counting on top of it. Collect sums every shard with relaxed loads, without stopping writers,
+ * so a snapshot can be a few updates behind but never goes backwards.
+ *
+ * Gauges and counters owned by other components are watched: a callback is registered once and read on Collect.
+ */
+class Metrics
+{
+public:
+    static Metrics &Get();
+
+    Metrics(const Metrics &) = delete;
+    Metrics &operator=(const Metrics &) = delete;
+
+public:
+    void Add(MetricCounter counter, uint64_t n = 1);
+    void AddPacket(uint8_t opcode, uint64_t bytes);
+    void Record(uint8_t opcode, MetricStage stage, uint64_t ns);
+
+    void Watch(const std::string &name, const std::string &help, MetricKind kind, std::function<double()> read);
+
+    MetricsSnapshot Collect() const;
+    std::vector<std::string> Report() const;
+
+    struct Watched
+    {
+        std::string name;
+        std::string help;
+        MetricKind kind;
+        std::function<double()> read;
+    };
+
+    std::vector<Watched> GetWatched() const;
+
+    static inline uint64_t Now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static const char *StageName(MetricStage stage);
+    static std::string OpcodeLabel(int opcode);
+
+private:
+    Metrics() = default;
+
+    struct Shard
+    {
+        std::array<std::atomic<uint64_t>, static_cast<size_t>(MetricCounter::COUNT)> counters{};
+        std::array<std::atomic<uint64_t>, 256> opcodePackets{};
+        std::array<std::atomic<uint64_t>, 256> opcodeBytes{};
+
+        // Allocated on the first value of the opcode and stage
+        std::array<std::atomic<MetricsHistogram *>, 256 * static_cast<size_t>(MetricStage::COUNT)> histograms{};
+    };
+
+    struct LocalShard
+    {
+        Shard *shard = nullptr;
+        ~LocalShard();
+    };
+
+    Shard &Local();
+    Shard *Acquire();
+    void Release(Shard *shard);
+
+private:
+    std::array<std::atomic<Shard *>, METRICS_MAX_SHARDS> m_shards{};
+    std::atomic<size_t> m_shardCount{0};
+
+    // Only taken when a thread starts or exits and when registering watches
+    mutable std::mutex m_mtx;
+    std::vector<Shard *> m_free;
+    std::vector<Watched> m_watched;
+};
+
+/**
+ * @class PacketTimer
+ * @brief Times one packet through the client thread. Stages are kept locally and recorded
+ *        when the timer goes out of scope, as long as the packet was decoded.
+ */
+class PacketTimer
+{
+public:
+    // started is when the first header bytes arrived, 0 if unknown
+    PacketTimer(uint64_t started);
+    ~PacketTimer();
+
+    PacketTimer(const PacketTimer &) = delete;
+    PacketTimer &operator=(const PacketTimer &) = delete;
+
+public:
+    void Decoded(uint8_t opcode, uint64_t bytes);
+    void Mark(MetricStage stage);
+
+private:
+    uint64_t m_started = 0;
+    uint64_t m_last = 0;
+    int m_opcode = -1;
+    std::array<uint64_t, static_cast<size_t>(MetricStage::COUNT)> m_stages{};
+};
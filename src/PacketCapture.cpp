@@ -0,0 +1,172 @@
+#include "PacketCapture.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "../Logger/Logger/Clock.h"
+#include "../Logger/Logger/WriteAll.h"
+
+/*
+    Creates the capture file and starts the writer thread. A capture left by the previous run is kept as <path>.old.
+    If the file cannot be created the capture stays closed and every frame is dropped.
+*/
+PacketCapture::PacketCapture(const std::string &path, long long maxBytes) : m_maxBytes(maxBytes)
+{
+    rename(path.c_str(), (path + ".old").c_str());
+
+    m_fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (m_fd < 0)
+    {
+        m_fd = -1;
+        m_full.store(true, std::memory_order_relaxed);
+        return;
+    }
+
+    m_startNs = Clock::Get().MonotonicNs();
+
+    CaptureHeader header{};
+    std::memcpy(header.magic, CAPTURE_MAGIC, sizeof(header.magic));
+    header.startUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+    if (write(m_fd, &header, sizeof(header)) != sizeof(header))
+    {
+        close(m_fd);
+        m_fd = -1;
+        m_full.store(true, std::memory_order_relaxed);
+        return;
+    }
+
+    m_written = sizeof(header);
+    m_thread = std::thread(&PacketCapture::Writer, this);
+}
+
+PacketCapture::~PacketCapture()
+{
+    if (m_thread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_running = false;
+        }
+        m_pending.notify_one();
+
+        m_thread.join();
+    }
+
+    if (m_fd != -1)
+        close(m_fd);
+}
+
+/**
+ * @brief Queues a frame for the writer thread. Never waits on the disk.
+ * @return False if the frame was dropped.
+ */
+bool PacketCapture::Record(int fd, CaptureDirection direction, const unsigned char *data, size_t size)
+{
+    if (m_full.load(std::memory_order_relaxed) || size > UINT32_MAX)
+    {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    Pending pending{};
+    pending.record.timeNs = Clock::Get().MonotonicNs() - m_startNs;
+    pending.record.fd = fd;
+    pending.record.direction = direction;
+    pending.record.length = static_cast<uint32_t>(size);
+    pending.frame.assign(data, data + size);
+
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+
+        if (m_queuedBytes + size > CAPTURE_QUEUE_BYTES)
+        {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        m_queuedBytes += size;
+        m_queue.push_back(std::move(pending));
+    }
+
+    m_pending.notify_one();
+    return true;
+}
+
+/*
+    Writes whatever was queued since the last batch until destroyed, what is still queued on exit is written first.
+*/
+void PacketCapture::Writer()
+{
+    pthread_setname_np(pthread_self(), "pgn-capture");
+
+    std::deque<Pending> batch;
+
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mtx);
+            m_pending.wait(lock, [this] { return !m_queue.empty() || !m_running; });
+
+            if (m_queue.empty())
+                return;
+
+            batch.swap(m_queue);
+            m_queuedBytes = 0;
+        }
+
+        if (!WriteBatch(batch))
+            m_full.store(true, std::memory_order_relaxed);
+
+        batch.clear();
+    }
+}
+
+/*
+    Writes a batch with as few writev calls as IOV_MAX allows. Stops at the size limit, records past it are dropped whole
+    so the file always ends on a record boundary.
+*/
+bool PacketCapture::WriteBatch(std::deque<Pending> &batch)
+{
+    std::vector<iovec> iov;
+    iov.reserve(std::min<size_t>(batch.size() * 2, IOV_MAX));
+
+    size_t next = 0;
+    bool limited = false;
+
+    while (next < batch.size() && !limited)
+    {
+        iov.clear();
+
+        for (; next < batch.size() && iov.size() + 2 <= IOV_MAX; next++)
+        {
+            Pending &pending = batch[next];
+            long long size = sizeof(CaptureRecord) + pending.frame.size();
+
+            if (m_maxBytes > 0 && m_written + size > m_maxBytes)
+            {
+                m_dropped.fetch_add(batch.size() - next, std::memory_order_relaxed);
+                limited = true;
+                break;
+            }
+
+            m_written += size;
+            iov.push_back(iovec{&pending.record, sizeof(CaptureRecord)});
+            if (!pending.frame.empty())
+                iov.push_back(iovec{pending.frame.data(), pending.frame.size()});
+        }
+
+        if (!WritevAll(m_fd, iov.data(), iov.size()))
+            return false;
+    }
+
+    return !limited;
+}
@@ -0,0 +1,115 @@
+/*
+ *   @author jozese
+ *
+ *
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define CAPTURE_MAGIC "PGNCAP01"
+
+// Frames waiting for the writer thread, past this new frames are dropped instead of stalling the client threads
+#ifndef CAPTURE_QUEUE_BYTES
+#define CAPTURE_QUEUE_BYTES (64 * 1024 * 1024)
+#endif
+
+enum class CaptureDirection : uint8_t
+{
+    // A frame read from the client
+    IN = 0,
+    // The connection was closed, length is 0. The fd can be reused by a later connection
+    CLOSE = 1,
+};
+
+/*
+    File layout: CaptureHeader, then one CaptureRecord followed by length bytes of frame per event.
+    Everything is written in host byte order.
+*/
+struct CaptureHeader
+{
+    char magic[8];
+    // Wall clock of the start of the capture, record times are relative to it
+    uint64_t startUs;
+};
+
+struct CaptureRecord
+{
+    // Since the start of the capture, with the resolution of the shared clock
+    uint64_t timeNs;
+    int32_t fd;
+    CaptureDirection direction;
+    uint8_t reserved[3];
+    uint32_t length;
+    uint32_t reserved2;
+};
+
+static_assert(sizeof(CaptureHeader) == 16, "Capture header layout changed");
+static_assert(sizeof(CaptureRecord) == 24, "Capture record layout changed");
+
+/**
+ * @class PacketCapture
+ * @brief Records inbound frames into a compact binary capture file that PigeonReplay can re-inject into a server.
+ *
+ * Client threads only copy the frame into a queue; a background thread writes the queue to the file with
+ * one writev per batch. Nothing blocks on the disk: when the queue is over CAPTURE_QUEUE_BYTES or the
+ * file reached its size limit the frame is dropped and counted.
+ */
+class PacketCapture
+{
+public:
+    PacketCapture(const std::string &path, long long maxBytes);
+    ~PacketCapture();
+
+    PacketCapture(const PacketCapture &) = delete;
+    PacketCapture &operator=(const PacketCapture &) = delete;
+
+public:
+    bool Record(int fd, CaptureDirection direction, const unsigned char *data, size_t size);
+
+    inline bool IsOpen() const
+    {
+        return m_fd != -1;
+    }
+
+    inline uint64_t GetDropped() const
+    {
+        return m_dropped.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Pending
+    {
+        CaptureRecord record;
+        std::vector<unsigned char> frame;
+    };
+
+    void Writer();
+    bool WriteBatch(std::deque<Pending> &batch);
+
+private:
+    int m_fd = -1;
+    long long m_maxBytes = 0;
+    long long m_written = 0;
+    uint64_t m_startNs = 0;
+
+    std::atomic<bool> m_full{false};
+    std::atomic<uint64_t> m_dropped{0};
+
+    std::mutex m_mtx;
+    std::condition_variable m_pending;
+    std::deque<Pending> m_queue;
+    size_t m_queuedBytes = 0;
+    bool m_running = true;
+
+    std::thread m_thread;
+};
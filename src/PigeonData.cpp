@@ -25,8 +25,133 @@ bool PigeonData::ReadConfig(){
     if(!parsed)
         return false;
 
-    for (const auto& key : root.getMemberNames()) {
-        m_data[key] = root[key];
-    }
+    auto config = std::make_shared<PigeonConfig>();
+
+    if(!ParseConfig(root, *config))
+        return false;
+
+    m_config.store(std::move(config), std::memory_order_release);
+    return true;
+}
+
+/*
+    Fills a PigeonConfig from the parsed json. Returns false if a field has the wrong type
+    or an invalid value, in that case config must not be published.
+*/
+bool PigeonData::ParseConfig(const Json::Value& root, PigeonConfig& config) const{
+
+    if(!root.isObject())
+        return false;
+
+    auto isString = [&root](const char* key){ return !root.isMember(key) || root[key].isString(); };
+    auto isInt = [&root](const char* key){ return !root.isMember(key) || root[key].isInt(); };
+
+    if(!isString("servername") || !isString("cert") || !isString("key") || !isString("MOTD") || !isString("durability") || !isString("logoverflow") || !isString("loglevel") || !isString("logbinary") || !isString("logfile") || !isString("capture"))
+        return false;
+
+    if(!isInt("port") || !isInt("ratelimit") || !isInt("sizelimit") || !isInt("mediacache") || !isInt("iothreads") || !isInt("history"))
+        return false;
+
+    if(!isInt("mediaretention") || !isInt("mediabudget") || !isInt("userquota") || !isInt("directio") || !isInt("logbuffer") || !isInt("logfilesize") || !isInt("logrotate") || !isInt("clocktick") || !isInt("LogPktBytes") || !isInt("capturesize") || !isInt("statsport"))
+        return false;
+
+    if((root.isMember("LogPkt") && !root["LogPkt"].isBool()) || (root.isMember("logconsole") && !root["logconsole"].isBool()))
+        return false;
+
+    int port = root.get("port", 0).asInt();
+    if(port <= 0 || port > 65535)
+        return false;
+
+    config.serverName = root.get("servername", "").asString();
+    config.port = static_cast<unsigned short>(port);
+    config.cert = root.get("cert", "").asString();
+    config.key = root.get("key", "").asString();
+    config.motd = root.get("MOTD", "").asString();
+    config.logPkt = root.get("LogPkt", false).asBool();
+    config.logPktBytes = root.get("LogPktBytes", 512).asInt();
+    config.rateLimit = root.get("ratelimit", 0).asInt();
+    config.sizeLimit = root.get("sizelimit", 0).asInt();
+
+    if(config.rateLimit < 0 || config.sizeLimit < 0 || config.logPktBytes < 0)
+        return false;
+
+    // 0 dumps whole packets, anything else must leave at least a full line for the head and the tail
+    if(config.logPktBytes > 0 && config.logPktBytes < 32)
+        return false;
+
+    config.sizeLimitBytes = static_cast<long long>(config.sizeLimit) * 1000 * 1000;
+
+    int mediaCache = root.get("mediacache", 64).asInt();
+    if(mediaCache < 0)
+        return false;
+
+    config.mediaCacheBytes = static_cast<long long>(mediaCache) * 1000 * 1000;
+
+    config.ioThreads = root.get("iothreads", 4).asInt();
+    if(config.ioThreads < 1 || config.ioThreads > 64)
+        return false;
+
+    int mediaRetention = root.get("mediaretention", 0).asInt();
+    int mediaBudget = root.get("mediabudget", 0).asInt();
+    int userQuota = root.get("userquota", 0).asInt();
+    if(mediaRetention < 0 || mediaBudget < 0 || userQuota < 0)
+        return false;
+
+    config.mediaRetentionSeconds = static_cast<long long>(mediaRetention) * 3600;
+    config.mediaBudgetBytes = static_cast<long long>(mediaBudget) * 1000 * 1000;
+    config.userQuotaBytes = static_cast<long long>(userQuota) * 1000 * 1000;
+
+    int directIo = root.get("directio", 0).asInt();
+    if(directIo < 0)
+        return false;
+
+    config.directIoBytes = static_cast<long long>(directIo) * 1000 * 1000;
+
+    config.history = root.get("history", 50).asInt();
+    if(config.history < 0 || config.history > 1000)
+        return false;
+
+    if(!GroupCommit::ParseDurability(root.get("durability", "batch").asString(), config.durability))
+        return false;
+
+    config.logBuffer = root.get("logbuffer", 8192).asInt();
+    if(config.logBuffer < 16 || config.logBuffer > 1 << 20)
+        return false;
+
+    if(!Logger::ParseOverflowPolicy(root.get("logoverflow", "block").asString(), config.logOverflow))
+        return false;
+
+    if(!Logger::ParseLevel(root.get("loglevel", "debug").asString(), config.logLevel))
+        return false;
+
+    config.logBinary = root.get("logbinary", "").asString();
+
+    config.logFile = root.get("logfile", "").asString();
+    int logFileSize = root.get("logfilesize", 64).asInt();
+    int logRotate = root.get("logrotate", 24).asInt();
+    if(logFileSize < 0 || logRotate < 0)
+        return false;
+
+    config.logFileBytes = static_cast<long long>(logFileSize) * 1000 * 1000;
+    config.logRotateSeconds = static_cast<long long>(logRotate) * 3600;
+    config.logConsole = root.get("logconsole", true).asBool();
+
+    config.clockTick = root.get("clocktick", 1000).asInt();
+    if(config.clockTick < 100 || config.clockTick > 1000000)
+        return false;
+
+    config.capture = root.get("capture", "").asString();
+    int captureSize = root.get("capturesize", 1000).asInt();
+    if(captureSize < 0)
+        return false;
+
+    config.captureBytes = static_cast<long long>(captureSize) * 1000 * 1000;
+
+    int statsPort = root.get("statsport", 0).asInt();
+    if(statsPort < 0 || statsPort > 65535 || (statsPort != 0 && statsPort == port))
+        return false;
+
+    config.statsPort = static_cast<unsigned short>(statsPort);
+
     return true;
-}
\ No newline at end of file
+}
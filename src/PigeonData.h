@@ -5,8 +5,83 @@
 #include <iostream>
 #include <fstream>
 #include <string>
-#include <unordered_map>
+#include <memory>
+#include <atomic>
 
+#include "GroupCommit.h"
+#include "../Logger/Logger/Logger.h"
+
+/**
+ * @struct PigeonConfig
+ * @brief Typed view of config.json. Parsed once per load and never modified afterwards,
+ *        so it can be shared between threads without locking.
+ */
+struct PigeonConfig
+{
+    std::string serverName = "";
+    unsigned short port = 0;
+    std::string cert = "";
+    std::string key = "";
+    std::string motd = "";
+    bool logPkt = false;
+
+    // Bytes of a packet dumped when logPkt is on, bigger packets keep their head and tail. 0 dumps everything
+    int logPktBytes = 512;
+
+    // Seconds a client must wait between media requests
+    int rateLimit = 0;
+
+    // Max media payload, sizeLimit is in MB as written in the config, sizeLimitBytes is precomputed
+    int sizeLimit = 0;
+    long long sizeLimitBytes = 0;
+
+    // Memory budget of the media download cache, in MB in the config
+    long long mediaCacheBytes = 64LL * 1000 * 1000;
+
+    // Threads of each media disk I/O pool, uploads and downloads have one each. Only read at startup
+    int ioThreads = 4;
+
+    // Media retention: age in hours, total and per uploader budgets in MB in the config. 0 is no limit
+    long long mediaRetentionSeconds = 0;
+    long long mediaBudgetBytes = 0;
+    long long userQuotaBytes = 0;
+
+    // Uploads of at least this size are written bypassing the page cache, in MB in the config. 0 is off
+    long long directIoBytes = 0;
+
+    // Frames per channel kept in history and replayed on join, 0 disables it
+    int history = 50;
+
+    // How appends to the history and media logs are flushed: "none", "batch" or "write"
+    Durability durability = Durability::BATCH;
+
+    // Size of the logger ring and what happens when it is full, only read at startup
+    int logBuffer = 8192;
+    OverflowPolicy logOverflow = OverflowPolicy::BLOCK;
+
+    // Least severe level that is logged, as Logger::Severity
+    int logLevel = 0;
+
+    // Binary log file for LOGF lines, empty logs them as text. Only read at startup
+    std::string logBinary = "";
+
+    // Log file, rotated by size (MB in the config) and age (hours in the config), 0 disables either.
+    // Only read at startup, logConsole can be changed on reload
+    std::string logFile = "";
+    long long logFileBytes = 64LL * 1000 * 1000;
+    long long logRotateSeconds = 24 * 3600;
+    bool logConsole = true;
+
+    // Refresh interval of the shared coarse clock, in microseconds
+    int clockTick = 1000;
+
+    // Capture file for inbound frames, empty disables it. Size limit in MB in the config, 0 is no limit. Only read at startup
+    std::string capture = "";
+    long long captureBytes = 1000LL * 1000 * 1000;
+
+    // Port of the metrics endpoint on 127.0.0.1, 0 disables it. Only read at startup
+    unsigned short statsPort = 0;
+};
 
 class PigeonData{
 
@@ -14,19 +89,32 @@ class PigeonData{
 public:
 
     PigeonData(const std::string& path);
+    /*
+        Parses and validates the config file, then swaps it in as the active snapshot.
+        On failure the previous snapshot stays active. Safe to call while the server is running.
+    */
     bool ReadConfig();
 
-    std::unordered_map<std::string, Json::Value> GetData() const{
-        return m_data;
+    /*
+        Returns the active config snapshot. Costs one atomic load, callers should keep
+        the returned pointer for the whole packet instead of calling this repeatedly.
+    */
+    std::shared_ptr<const PigeonConfig> GetConfig() const{
+        return m_config.load(std::memory_order_acquire);
+    }
+
+    const std::string& GetPath() const{
+        return m_path;
     }
 
 private:
 
-    std::unordered_map<std::string, Json::Value> m_data = {};
+    bool ParseConfig(const Json::Value& root, PigeonConfig& config) const;
+
+    std::atomic<std::shared_ptr<const PigeonConfig>> m_config;
     std::string m_path = "";
 
 };
 
 
 
-
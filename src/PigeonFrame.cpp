@@ -0,0 +1,76 @@
+#include "PigeonFrame.h"
+
+#include <cstring>
+
+FrameTemplate::FrameTemplate(PIGEON_OPCODE opcode, const std::vector<unsigned char> &payload)
+{
+    int contentLength = payload.size();
+
+    m_tail.reserve(sizeof(unsigned char) + sizeof(int) + payload.size());
+    m_tail.push_back(static_cast<unsigned char>(opcode));
+
+    unsigned char *contentLengthBytes = reinterpret_cast<unsigned char *>(&contentLength);
+    m_tail.insert(m_tail.end(), contentLengthBytes, contentLengthBytes + sizeof(int));
+    m_tail.insert(m_tail.end(), payload.begin(), payload.end());
+}
+
+/*
+    Same as above, the payload is the concatenation of payloadParts. Avoids building the payload in a temporary buffer first.
+*/
+FrameTemplate::FrameTemplate(PIGEON_OPCODE opcode, std::initializer_list<std::string_view> payloadParts)
+{
+    size_t payloadSize = 0;
+    for (auto part : payloadParts)
+        payloadSize += part.size();
+
+    int contentLength = payloadSize;
+
+    m_tail.reserve(sizeof(unsigned char) + sizeof(int) + payloadSize);
+    m_tail.push_back(static_cast<unsigned char>(opcode));
+
+    unsigned char *contentLengthBytes = reinterpret_cast<unsigned char *>(&contentLength);
+    m_tail.insert(m_tail.end(), contentLengthBytes, contentLengthBytes + sizeof(int));
+
+    for (auto part : payloadParts)
+        m_tail.insert(m_tail.end(), part.begin(), part.end());
+}
+
+/**
+ * @brief Renders only the part of the frame before the tail: header length, timestamp and username.
+ * @param username Username to be in the header.
+ * @param timestamp Timestamp to be in the header.
+ * @return The serialized header, to be sent followed by Tail().
+ */
+std::vector<unsigned char> FrameTemplate::RenderHeader(const std::string &username, std::time_t timestamp) const
+{
+    int headerLength = sizeof(std::time_t) + username.length() + 1 + sizeof(unsigned char) + sizeof(int);
+
+    std::vector<unsigned char> header(sizeof(int) + sizeof(std::time_t) + username.length() + 1);
+    unsigned char *out = header.data();
+
+    std::memcpy(out, &headerLength, sizeof(int));
+    out += sizeof(int);
+
+    std::memcpy(out, &timestamp, sizeof(std::time_t));
+    out += sizeof(std::time_t);
+
+    std::memcpy(out, username.data(), username.length());
+    out += username.length();
+    *out = '\0';
+
+    return header;
+}
+
+/**
+ * @brief Renders the template into a full frame, same layout as PigeonServer::SerializePacket.
+ * @param username Username to be in the header.
+ * @param timestamp Timestamp to be in the header.
+ * @return The serialized frame.
+ */
+std::vector<unsigned char> FrameTemplate::Render(const std::string &username, std::time_t timestamp) const
+{
+    std::vector<unsigned char> frame = RenderHeader(username, timestamp);
+    frame.insert(frame.end(), m_tail.begin(), m_tail.end());
+
+    return frame;
+}
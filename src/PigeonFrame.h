@@ -0,0 +1,59 @@
+#pragma once
+
+#include "PigeonPacket.h"
+#include "PigeonData.h"
+
+#include <array>
+#include <memory>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <initializer_list>
+#include <ctime>
+
+/**
+ * @class FrameTemplate
+ * @brief A pre-serialized response. Everything after the username (opcode, content length and payload)
+ * is serialized once, rendering only writes the header length, timestamp and username in front of it.
+ */
+class FrameTemplate
+{
+public:
+    FrameTemplate() = default;
+    FrameTemplate(PIGEON_OPCODE opcode, const std::vector<unsigned char> &payload);
+    FrameTemplate(PIGEON_OPCODE opcode, std::initializer_list<std::string_view> payloadParts);
+
+    std::vector<unsigned char> Render(const std::string &username, std::time_t timestamp) const;
+    std::vector<unsigned char> RenderHeader(const std::string &username, std::time_t timestamp) const;
+
+    // Everything after the username, can be sent right after RenderHeader without copying it
+    inline const std::vector<unsigned char> &Tail() const
+    {
+        return m_tail;
+    }
+
+    inline bool Empty() const
+    {
+        return m_tail.empty();
+    }
+
+private:
+    // opcode + content length + payload
+    std::vector<unsigned char> m_tail;
+};
+
+/**
+ * @struct ResponseFrames
+ * @brief Responses whose payload only depends on the config (SERVER_HELLO and error opcodes).
+ * Built at startup and on every config reload, together with the config snapshot they were built from.
+ */
+struct ResponseFrames
+{
+    std::shared_ptr<const PigeonConfig> config;
+    std::array<FrameTemplate, 256> frames;
+
+    inline const FrameTemplate &Get(PIGEON_OPCODE opcode) const
+    {
+        return frames[static_cast<unsigned char>(opcode)];
+    }
+};
@@ -4,9 +4,12 @@
 #include <vector>
 #include <iostream>
 #include <string>
+#include <memory>
 
 #define MAX_USERNAME 20
 #define MAX_HEADER 38
+#define MAX_CHANNEL 32
+#define DEFAULT_CHANNEL "general"
 
 enum PIGEON_OPCODE
 {
@@ -21,10 +24,18 @@ enum PIGEON_OPCODE
     MEDIA_DOWNLOAD = 0x12,
     ACK_MEDIA_DOWNLOAD = 0x13,
 
+    // DIRECT MESSAGE, ONLY SENT TO THE RECIPIENT
+    DIRECT_MESSAGE = 0x14,
+
     // PRESENCE, ALSO BROADCASTABLE
     PRESENCE_REQUEST = 0x20,
     PRESENCE_UPDATE = 0x22,
 
+    // CHANNELS, MESSAGES ARE ONLY SENT TO THE CHANNEL MEMBERS
+    CHANNEL_JOIN = 0x30,
+    CHANNEL_LEAVE = 0x31,
+    CHANNEL_MESSAGE = 0x32,
+
     // CLOSING EVENTS (not used but should be used)
     CLIENT_DISCONNECT = 0xF0,
 
@@ -37,9 +48,45 @@ enum PIGEON_OPCODE
     RATE_LIMITED = 0xE5,
     FILE_NOT_FOUND = 0xE6,
 
+    // NON FATAL ERRORS, ONLY SENT BACK TO THE SENDER
+    NOT_IN_CHANNEL = 0xD0,
+    USER_OFFLINE = 0xD1,
+    STORE_FAILED = 0xD2,
+
 
 };
 
+inline const char *OpcodeName(int opcode)
+{
+    switch (opcode)
+    {
+    case CLIENT_HELLO: return "CLIENT_HELLO";
+    case SERVER_HELLO: return "SERVER_HELLO";
+    case TEXT_MESSAGE: return "TEXT_MESSAGE";
+    case MEDIA_FILE: return "MEDIA_FILE";
+    case MEDIA_DOWNLOAD: return "MEDIA_DOWNLOAD";
+    case ACK_MEDIA_DOWNLOAD: return "ACK_MEDIA_DOWNLOAD";
+    case DIRECT_MESSAGE: return "DIRECT_MESSAGE";
+    case PRESENCE_REQUEST: return "PRESENCE_REQUEST";
+    case PRESENCE_UPDATE: return "PRESENCE_UPDATE";
+    case CHANNEL_JOIN: return "CHANNEL_JOIN";
+    case CHANNEL_LEAVE: return "CHANNEL_LEAVE";
+    case CHANNEL_MESSAGE: return "CHANNEL_MESSAGE";
+    case CLIENT_DISCONNECT: return "CLIENT_DISCONNECT";
+    case JSON_NOT_VALID: return "JSON_NOT_VALID";
+    case USER_COLLISION: return "USER_COLLISION";
+    case PROTOCOL_MISMATCH: return "PROTOCOL_MISMATCH";
+    case LENGTH_EXCEEDED: return "LENGTH_EXCEEDED";
+    case USERNAME_MISMATCH: return "USERNAME_MISMATCH";
+    case RATE_LIMITED: return "RATE_LIMITED";
+    case FILE_NOT_FOUND: return "FILE_NOT_FOUND";
+    case NOT_IN_CHANNEL: return "NOT_IN_CHANNEL";
+    case USER_OFFLINE: return "USER_OFFLINE";
+    case STORE_FAILED: return "STORE_FAILED";
+    default: return "UNKNOWN";
+    }
+}
+
 struct PigeonHeader
 {
     int HEADER_LENGTH;
@@ -49,9 +96,28 @@ struct PigeonHeader
     int CONTENT_LENGTH;
 };
 
+/*
+ * Where the server delivers a packet, never serialized
+ */
+struct PigeonRoute
+{
+    std::string channel;
+    std::string recipient;
+};
+
+struct MediaFile;
+class FrameTemplate;
+
 struct PigeonPacket
 {
 
     PigeonHeader HEADER;
     std::vector<unsigned char> PAYLOAD;
+    PigeonRoute ROUTE;
+
+    // Payload served from the media store instead of PAYLOAD, sent without copying it
+    std::shared_ptr<const MediaFile> MEDIA;
+
+    // Pre-serialized opcode + content length + payload, only the header is rendered when sending
+    std::shared_ptr<const FrameTemplate> FRAME;
 };
@@ -1,5 +1,17 @@
 #include "PigeonServer.h"
 
+/*
+ * Pipe used to forward signals to the config watcher thread. Signal handlers can only do
+ * async-signal-safe work, so they just write the signal number to it.
+ */
+static int g_signalPipe[2] = {-1, -1};
+
+static void OnSignal(int sig)
+{
+    unsigned char s = static_cast<unsigned char>(sig);
+    (void)!write(g_signalPipe[1], &s, 1);
+}
+
 /**
  * 
  * 
@@ -12,13 +24,13 @@
  */
 PigeonServer::PigeonServer(const std::string &certPath, const std::string &keyPath, const std::string &serverName, unsigned short port, Logger *logger) : TcpServer(certPath, keyPath, port), serverName(serverName), logger(logger)
 {
-    clients = new std::unordered_map<int, Client *>();
+    clients = new std::unordered_map<int, std::shared_ptr<Client>>();
 
-    logger->log(DEBUG, "Setting up TCP server");
+    LOG(logger, DEBUG, "Setting up TCP server");
 
     if (TcpServer::Setup() != 0)
     {
-        logger->log(ERROR, "Error while setting up tcp server");
+        LOG(logger, ERROR, "Error while setting up tcp server");
         exit(EXIT_FAILURE);
     }
 };
@@ -26,22 +38,63 @@ PigeonServer::PigeonServer(const std::string &certPath, const std::string &keyPa
 /*
 * @brief Constructor for PigeonServer class from Pigeon Data directly.
 */
-PigeonServer::PigeonServer(PigeonData &data, Logger *logger) : TcpServer(data.GetData()["cert"].asString(), data.GetData()["key"].asString(), (unsigned short)data.GetData()["port"].asInt()),
-                                                               serverName(data.GetData()["serverName"].asString()),
+PigeonServer::PigeonServer(PigeonData &data, Logger *logger) : TcpServer(data.GetConfig()->cert, data.GetConfig()->key, data.GetConfig()->port),
+                                                               serverName(data.GetConfig()->serverName),
                                                                logger(logger),
-                                                               m_data(&data)
+                                                               m_data(&data),
+                                                               m_history("Files/history.log", data.GetConfig()->history)
 {
-    clients = new std::unordered_map<int, Client *>();
+    clients = new std::unordered_map<int, std::shared_ptr<Client>>();
     
 
-    logger->log(DEBUG, "Setting up TCP server");
+    LOG(logger, DEBUG, "Setting up TCP server");
 
     if (TcpServer::Setup() != 0)
     {
-        logger->log(ERROR, "Error while setting up tcp server");
+        LOG(logger, ERROR, "Error while setting up tcp server");
         exit(EXIT_FAILURE);
     }
 
+    m_frames.store(BuildFrames(data.GetConfig()), std::memory_order_release);
+    m_mediaCache.SetBudget(data.GetConfig()->mediaCacheBytes);
+    m_io = std::make_unique<IoPool>(data.GetConfig()->ioThreads);
+    m_ioUpload = std::make_unique<IoPool>(data.GetConfig()->ioThreads, "pgn-io-upload");
+    m_media.SetDurability(data.GetConfig()->durability);
+    m_media.SetDirectIo(data.GetConfig()->directIoBytes);
+    m_history.SetDurability(data.GetConfig()->durability);
+
+    if (!data.GetConfig()->capture.empty())
+    {
+        m_capture = std::make_unique<PacketCapture>(data.GetConfig()->capture, data.GetConfig()->captureBytes);
+
+        if (m_capture->IsOpen())
+            LOGF(logger, INFO, "CAPTURING INBOUND FRAMES TO {}", data.GetConfig()->capture);
+        else
+            LOGF(logger, ERROR, "COULD NOT OPEN CAPTURE FILE {}", data.GetConfig()->capture);
+    }
+
+    Metrics &metrics = Metrics::Get();
+    metrics.Watch("pigeon_clients", "Open client connections", MetricKind::GAUGE, [this] { return static_cast<double>(m_clientCount.load(std::memory_order_relaxed)); });
+    metrics.Watch("pigeon_logged_clients", "Clients that completed CLIENT_HELLO", MetricKind::GAUGE, [this] { return static_cast<double>(m_loggedCount.load(std::memory_order_relaxed)); });
+    metrics.Watch("pigeon_io_pending", "Download disk tasks waiting for an I/O thread", MetricKind::GAUGE, [this] { return static_cast<double>(m_io->Pending()); });
+    metrics.Watch("pigeon_io_upload_pending", "Upload disk tasks waiting for an I/O thread", MetricKind::GAUGE, [this] { return static_cast<double>(m_ioUpload->Pending()); });
+    metrics.Watch("pigeon_media_cache_hits_total", "Media downloads served from the cache", MetricKind::COUNTER, [this] { return static_cast<double>(m_mediaCache.Hits()); });
+    metrics.Watch("pigeon_media_cache_misses_total", "Media downloads read from disk", MetricKind::COUNTER, [this] { return static_cast<double>(m_mediaCache.Misses()); });
+    metrics.Watch("pigeon_log_dropped_total", "Log lines dropped on a full logger ring", MetricKind::COUNTER, [logger] { return static_cast<double>(logger->Dropped()); });
+
+    if (m_capture)
+        metrics.Watch("pigeon_capture_dropped_total", "Frames the capture could not keep", MetricKind::COUNTER, [this] { return static_cast<double>(m_capture->GetDropped()); });
+
+    if (data.GetConfig()->statsPort != 0)
+    {
+        m_stats = std::make_unique<StatsServer>(data.GetConfig()->statsPort);
+
+        if (m_stats->Start())
+            LOGF(logger, INFO, "SERVING METRICS ON 127.0.0.1:{}/metrics", data.GetConfig()->statsPort);
+        else
+            LOGF(logger, ERROR, "COULD NOT BIND STATS PORT {}", data.GetConfig()->statsPort);
+    }
+
     /*
     * Watcher thread that prevents zombie tcp connections. If a tcp connection has not sent a CLIENT_HELLO message in 10 seconds
     * it will be instantly disconnected. DisconnectClient will close the socket and wake up the blocking main thread of the client,
@@ -49,10 +102,11 @@ PigeonServer::PigeonServer(PigeonData &data, Logger *logger) : TcpServer(data.Ge
     */
 
     std::thread([this]{
+        pthread_setname_np(pthread_self(), "pgn-watchdog");
         
         while (true)
         {
-            std::time_t currentCheckTime = std::time(0);
+            std::time_t currentCheckTime = Clock::Get().Now();
 
             std::unique_lock<std::mutex> lock(this->m_clientsMtx);
 
@@ -60,8 +114,8 @@ PigeonServer::PigeonServer(PigeonData &data, Logger *logger) : TcpServer(data.Ge
                 for(auto& client: *clients){
                     if(!client.second->hasLogged){
                         if(currentCheckTime - client.second->logTimestamp >= 10){
-                            this->logger->log(ERROR,"Zombie connection detected. Killing FD: " + std::to_string(client.first));
-                            DisconnectClient(client.first, client.second->clientSsl);
+                            LOG(this->logger, ERROR, "Zombie connection detected. Killing FD: " + std::to_string(client.first));
+                            DisconnectClient(client.first, *client.second);
                         }
                     }  
                 }
@@ -72,6 +126,212 @@ PigeonServer::PigeonServer(PigeonData &data, Logger *logger) : TcpServer(data.Ge
             std::this_thread::sleep_for(std::chrono::seconds(1));
         }
     }).detach();
+
+    /*
+    * Background compaction of media segments. Runs rarely and only copies the live blobs of segments that are at least half dead.
+    */
+    std::thread([this]
+    {
+        pthread_setname_np(pthread_self(), "pgn-compact");
+
+        while (true)
+        {
+            std::this_thread::sleep_for(std::chrono::minutes(5));
+
+            uint64_t reclaimed = m_media.Compact();
+            if (reclaimed > 0)
+                LOG(this->logger, INFO, "MEDIA SEGMENTS COMPACTED, RECLAIMED " + std::to_string(reclaimed / 1000) + " KB");
+        }
+    }).detach();
+
+    /*
+    * Media retention sweeper. Works off the media index with the lowest CPU and I/O priority, so it only
+    * uses what the client threads leave. Limits are read from the config on every sweep.
+    */
+    std::thread([this]
+    {
+        pthread_setname_np(pthread_self(), "pgn-sweeper");
+        setpriority(PRIO_PROCESS, gettid(), 19);
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+
+        while (true)
+        {
+            std::this_thread::sleep_for(std::chrono::minutes(1));
+
+            auto config = m_data->GetConfig();
+
+            RetentionPolicy policy;
+            policy.maxAge = config->mediaRetentionSeconds;
+            policy.maxBytes = config->mediaBudgetBytes;
+            policy.userQuota = config->userQuotaBytes;
+
+            auto removed = m_media.Sweep(policy, Clock::Get().Now());
+
+            for (auto &name : removed)
+                m_mediaCache.Erase(name);
+
+            if (!removed.empty())
+                LOG(this->logger, INFO, "MEDIA SWEEP REMOVED " + std::to_string(removed.size()) + " FILES");
+        }
+    }).detach();
+
+    WatchConfig();
+}
+
+/**
+ * @brief Starts the config watcher thread. The config is reloaded on SIGHUP or whenever the config file
+ * is written or replaced. Connections are not touched, packets already being processed keep the snapshot they started with.
+ * SIGUSR1 logs a metrics report.
+ */
+void PigeonServer::WatchConfig()
+{
+    if (pipe2(g_signalPipe, O_CLOEXEC | O_NONBLOCK) != 0)
+    {
+        LOG(logger, ERROR, "Error while setting up signal pipe, config reload disabled");
+        return;
+    }
+
+    struct sigaction sa = {};
+    sa.sa_handler = OnSignal;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGHUP, &sa, nullptr);
+    sigaction(SIGUSR1, &sa, nullptr);
+
+    // Watching the directory instead of the file itself, editors usually replace the file on save
+    std::string path = m_data->GetPath();
+    size_t slash = path.find_last_of('/');
+    std::string dir = slash == std::string::npos ? "." : path.substr(0, slash);
+    std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+
+    int inotifyFd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (inotifyFd >= 0 && inotify_add_watch(inotifyFd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+    {
+        close(inotifyFd);
+        inotifyFd = -1;
+    }
+
+    if (inotifyFd < 0)
+        LOG(logger, WARNING, "INOTIFY NOT AVAILABLE, CONFIG ONLY RELOADS ON SIGHUP");
+
+    std::thread([this, inotifyFd, name]
+    {
+        pthread_setname_np(pthread_self(), "pgn-config");
+        pollfd fds[2] = {{g_signalPipe[0], POLLIN, 0}, {inotifyFd, POLLIN, 0}};
+
+        while (true)
+        {
+            if (poll(fds, inotifyFd < 0 ? 1 : 2, -1) <= 0)
+                continue;
+
+            bool reload = false;
+            bool report = false;
+
+            if (fds[0].revents & POLLIN)
+            {
+                unsigned char sig = 0;
+                while (read(fds[0].fd, &sig, 1) == 1)
+                {
+                    if (sig == SIGHUP)
+                        reload = true;
+                    else if (sig == SIGUSR1)
+                        report = true;
+                }
+            }
+
+            if (inotifyFd >= 0 && (fds[1].revents & POLLIN))
+            {
+                alignas(inotify_event) char buf[4096];
+                ssize_t n = 0;
+                while ((n = read(inotifyFd, buf, sizeof(buf))) > 0)
+                {
+                    for (char *p = buf; p < buf + n;)
+                    {
+                        auto *event = reinterpret_cast<inotify_event *>(p);
+                        if (event->len > 0 && name == event->name)
+                            reload = true;
+                        p += sizeof(inotify_event) + event->len;
+                    }
+                }
+            }
+
+            if (reload)
+                ReloadConfig();
+
+            if (report)
+            {
+                for (auto &line : Metrics::Get().Report())
+                    LOG(logger, INFO, std::move(line));
+            }
+        }
+    }).detach();
+}
+
+/**
+ * @brief Reads the config file again and swaps it in if valid. If not, the previous config stays active.
+ */
+void PigeonServer::ReloadConfig()
+{
+    auto previous = m_data->GetConfig();
+
+    if (!m_data->ReadConfig())
+    {
+        LOG(logger, ERROR, "CONFIG RELOAD FAILED, KEEPING PREVIOUS CONFIG");
+        return;
+    }
+
+    auto current = m_data->GetConfig();
+
+    // Those are only used when setting up the server
+    if (current->port != previous->port || current->cert != previous->cert || current->key != previous->key || current->serverName != previous->serverName || current->ioThreads != previous->ioThreads ||
+        current->logBuffer != previous->logBuffer || current->logOverflow != previous->logOverflow || current->logBinary != previous->logBinary ||
+        current->logFile != previous->logFile || current->logFileBytes != previous->logFileBytes || current->logRotateSeconds != previous->logRotateSeconds ||
+        current->capture != previous->capture || current->captureBytes != previous->captureBytes || current->statsPort != previous->statsPort)
+        LOG(logger, WARNING, "CHANGES TO PORT, CERT, KEY, SERVERNAME, IOTHREADS, LOGGER, CAPTURE OR STATS SETTINGS NEED A RESTART");
+
+    m_frames.store(BuildFrames(current), std::memory_order_release);
+    m_mediaCache.SetBudget(current->mediaCacheBytes);
+    m_history.SetDepth(current->history);
+    logger->SetLevel(current->logLevel);
+    logger->SetConsole(current->logConsole);
+    Clock::Get().SetTick(std::chrono::microseconds(current->clockTick));
+    m_media.SetDurability(current->durability);
+    m_media.SetDirectIo(current->directIoBytes);
+    m_history.SetDurability(current->durability);
+
+    LOG(logger, INFO, "CONFIG RELOADED");
+}
+
+/**
+ * @brief Pre-serializes the responses that only depend on the config, so sending them only costs patching the username and timestamp.
+ * @param config Config snapshot the frames are built from.
+ */
+std::shared_ptr<const ResponseFrames> PigeonServer::BuildFrames(std::shared_ptr<const PigeonConfig> config)
+{
+    auto frames = std::make_shared<ResponseFrames>();
+
+    frames->frames[SERVER_HELLO] = FrameTemplate(SERVER_HELLO, String::StringToBytes(R"({"ServerName":")" + this->serverName + R"(","MOTD":")" + config->motd + R"(","sizelimit":)" + std::to_string(config->sizeLimit) + R"(})"));
+
+    for (PIGEON_OPCODE opcode : {JSON_NOT_VALID, USER_COLLISION, PROTOCOL_MISMATCH, LENGTH_EXCEEDED, USERNAME_MISMATCH, RATE_LIMITED, FILE_NOT_FOUND, NOT_IN_CHANNEL, USER_OFFLINE, STORE_FAILED})
+        frames->frames[opcode] = FrameTemplate(opcode, {});
+
+    frames->config = std::move(config);
+    return frames;
+}
+
+/**
+ * @brief Serializes a response, using the pre-serialized frame for its opcode when there is one.
+ * @param packet Packet built by ProcessPacket.
+ * @param frames Frames snapshot the packet was processed with.
+ */
+std::vector<unsigned char> PigeonServer::SerializeResponse(const PigeonPacket &packet, const ResponseFrames &frames)
+{
+    const FrameTemplate &frame = frames.Get(packet.HEADER.OPCODE);
+
+    if (frame.Empty())
+        return SerializePacket(packet);
+
+    return frame.Render(packet.HEADER.username, packet.HEADER.TIME_STAMP);
 }
 
 /**
@@ -103,7 +363,7 @@ void PigeonServer::Run()
         if (client < 0)
         {
 
-            logger->log(ERROR, "Failed TCP Handshake");
+            LOG(logger, ERROR, "Failed TCP Handshake");
 
             continue;
         }
@@ -113,7 +373,7 @@ void PigeonServer::Run()
             continue;
         }*/
 
-        logger->log(DEBUG, "OK TCP Handshake " + std::string(clientIp));
+        LOG(logger, DEBUG, "OK TCP Handshake " + std::string(clientIp));
 
         ssl = SSL_new(sslCtx);
         SSL_set_fd(ssl, client);
@@ -121,7 +381,7 @@ void PigeonServer::Run()
         if (SSL_accept(ssl) == 0)
         {
 
-            logger->log(ERROR, "Failed TLS Handshake " + std::string(clientIp));
+            LOG(logger, ERROR, "Failed TLS Handshake " + std::string(clientIp));
 
             SSL_shutdown(ssl);
             SSL_free(ssl);
@@ -130,18 +390,21 @@ void PigeonServer::Run()
         else
         {
 
-            logger->log(DEBUG, "OK TLS Handshake " + std::string(clientIp));
+            LOG(logger, DEBUG, "OK TLS Handshake " + std::string(clientIp));
 
-            Client *newClient = new Client();
+            auto newClient = std::make_shared<Client>();
             newClient->clientSsl = ssl;
             newClient->ipv4 = std::string(clientIp);
-            newClient->logTimestamp = std::time(0);
+            newClient->logTimestamp = Clock::Get().Now();
 
             //manual lock
             std::unique_lock<std::mutex> lock(this->m_clientsMtx);
-            auto clientIter = clients->insert({client, newClient});
+            clients->insert({client, newClient});
+            m_clientCount.store(clients->size(), std::memory_order_relaxed);
             lock.unlock();
 
+            Metrics::Get().Add(MetricCounter::CONNECTIONS);
+
             /*
              *  Each client is managed within its own thread. Probably not the best approach efficiently wise, but its pretty simple to implement.
              *  Others approach with select() and non blocking network I/O calls might perform better but are not as easy to implement.
@@ -151,59 +414,83 @@ void PigeonServer::Run()
              *
              */
 
-            std::thread([clientIter, this]
+            std::thread([clientFd = client, self = newClient, this]
             {         
-                    logger->log(INFO," [INFO] NEW THREAD FOR CLIENT FD: " + std::to_string(clientIter.first->first));
+                    pthread_setname_np(pthread_self(), "pgn-client");
+                    LOG(logger, INFO, " [INFO] NEW THREAD FOR CLIENT FD: " + std::to_string(clientFd));
 
                     while (1)
                     {   
                     
                         // thread will block here untill a disconnection (empty packet) or an actual packet was read.
-                        std::vector<unsigned char> clientPacket = ReadPacket(clientIter.first->second->clientSsl);
+                        uint64_t readStarted = 0;
+                        std::vector<unsigned char> clientPacket = ReadPacket(self->clientSsl, &readStarted);
+
+                        // Records the stages of this packet when the iteration ends, whichever way it ends
+                        PacketTimer timer(readStarted);
 
-                        if(m_data->GetData()["LogPkt"].asBool())
-                            logger->log(DEBUG, "NEW PKT: " + String::HexToString(clientPacket));
+                        // Snapshot taken once per packet, the whole packet is processed with the same config and frames
+                        auto frames = m_frames.load(std::memory_order_acquire);
+                        const PigeonConfig &config = *frames->config;
+
+                        if(config.logPkt && logger->IsEnabled(DEBUG)){
+                            // Reused by every packet of this client thread
+                            static thread_local std::string packetDump;
+                            String::HexDump(clientPacket.data(), clientPacket.size(), config.logPktBytes, packetDump);
+                            LOG(logger, DEBUG, "NEW PKT: " + packetDump);
+                        }
+
+                        if(m_capture){
+                            if(clientPacket.empty())
+                                m_capture->Record(clientFd, CaptureDirection::CLOSE, nullptr, 0);
+                            else if(!m_capture->Record(clientFd, CaptureDirection::IN, clientPacket.data(), clientPacket.size()))
+                                LOGF_THROTTLED(logger, WARNING, 1, 1, "CAPTURE DROPPED A FRAME, {} DROPPED SO FAR", m_capture->GetDropped());
+                        }
 
 
                         if(clientPacket.empty())
                         {
                                 std::lock_guard<std::mutex> lock(this->m_clientsMtx);
 
-                                    if(clients->find(clientIter.first->first) != clients->end()){
+                                    if(clients->find(clientFd) != clients->end()){
                                             
-                                        logger->log(DEBUG,"ENDED THREAD FOR FD: " + std::to_string(clientIter.first->first));
+                                        LOG(logger, DEBUG, "ENDED THREAD FOR FD: " + std::to_string(clientFd));
 
-                                        DisconnectClient(clientIter.first->first,clientIter.first->second->clientSsl);
-                                        FreeClient(clientIter.first->first);
+                                        DisconnectClient(clientFd, *self);
+                                        FreeClient(clientFd);
                                         
                                         this->NotifyNewPresence();
   
                                     }
 
-                                logger->log(INFO,"AMOUNT OF CLIENTS: " + std::to_string(clients->size()));
+                                LOG(logger, INFO, "AMOUNT OF CLIENTS: " + std::to_string(clients->size()));
                             break;
                         }
                         
 
                         auto clientPigeonPacket = DeserializePacket(clientPacket);
+                        timer.Decoded(clientPigeonPacket.HEADER.OPCODE, clientPacket.size());
                    
-                        PigeonPacket toSend = ProcessPacket(clientPigeonPacket,clientIter.first->first);
+                        PigeonPacket toSend = ProcessPacket(clientPigeonPacket,clientFd,config);
+                        timer.Mark(MetricStage::PROCESS);
 
                         //Send file to specific client
                         if(toSend.HEADER.OPCODE == ACK_MEDIA_DOWNLOAD){
                                                          
-                            logger->log(INFO,"SENDING FILE TO " + clientIter.first->second->username);
+                            LOGF(logger, INFO, "SENDING FILE TO {}", self->username);
  
-                             auto bufToSend = SerializePacket(toSend);
-                             SendAll(bufToSend,clientIter.first->second->clientSsl);
+                             SendMedia(toSend,*self);
                              continue;
                         }
 
                         //if to send is server_hello, that means a successfull client_hello was read, so we notify the right client and then we broadcast the new presence list to evry client
                         if(toSend.HEADER.OPCODE == SERVER_HELLO){
 
-                            auto bufToSend = SerializePacket(toSend);
-                            SendAll(bufToSend,clientIter.first->second->clientSsl);
+                            //Recent history of the default channel goes in the same write as the hello
+                            auto bufToSend = SerializeResponse(toSend, *frames);
+                            auto tail = m_history.Tail(DEFAULT_CHANNEL);
+                            bufToSend.insert(bufToSend.end(), tail.begin(), tail.end());
+                            SendAll(bufToSend,*self);
                             
                             this->NotifyNewPresence();
 
@@ -216,26 +503,60 @@ void PigeonServer::Run()
                             continue;
                         }
 
+                        //Channel acks and non fatal errors only go back to the sender
+                        if(toSend.HEADER.OPCODE == CHANNEL_JOIN || toSend.HEADER.OPCODE == CHANNEL_LEAVE || (toSend.HEADER.OPCODE & 0xF0) == 0xD0){
+                            auto bufToSend = SerializeResponse(toSend, *frames);
+
+                            //A join ack is followed by the recent history of the channel
+                            if(toSend.HEADER.OPCODE == CHANNEL_JOIN){
+                                auto tail = m_history.Tail(toSend.ROUTE.channel);
+                                bufToSend.insert(bufToSend.end(), tail.begin(), tail.end());
+                            }
+
+                            SendAll(bufToSend,*self);
+                            continue;
+                        }
+
+                        //Direct messages only go to the recipient, the sender is told if the recipient is not online
+                        if(!toSend.ROUTE.recipient.empty()){
+                            if(!UnicastPacket(toSend, toSend.ROUTE.recipient)){
+                                auto bufToSend = frames->Get(USER_OFFLINE).Render(self->username, Clock::Get().Now());
+                                SendAll(bufToSend,*self);
+                            }
+                            continue;
+                        }
+
                         //bad packet, close connection and notify all clients
                         if((toSend.HEADER.OPCODE & 0xF0) == 0xE0){
-                            if(clients->find(clientIter.first->first) != clients->end()){                             
+                            std::lock_guard<std::mutex> lock(this->m_clientsMtx);
+
+                            if(clients->find(clientFd) != clients->end()){                             
                                 
-                                logger->log(DEBUG,"ENDED THREAD FOR FD: " + std::to_string(clientIter.first->first));                                
+                                LOG(logger, DEBUG, "ENDED THREAD FOR FD: " + std::to_string(clientFd));                                
 
-                                auto buf = SerializePacket(toSend);
-                                SendAll(buf,clientIter.first->second->clientSsl);
+                                auto buf = SerializeResponse(toSend, *frames);
+                                SendAll(buf,*self);
 
-                                DisconnectClient(clientIter.first->first,clientIter.first->second->clientSsl);
-                                FreeClient(clientIter.first->first);
+                                if(m_capture)
+                                    m_capture->Record(clientFd, CaptureDirection::CLOSE, nullptr, 0);
+
+                                DisconnectClient(clientFd, *self);
+                                FreeClient(clientFd);
 
                                 this->NotifyNewPresence();
 
-                                logger->log(INFO,"AMOUNT OF CLIENTS: " + std::to_string(clients->size()));
+                                LOG(logger, INFO, "AMOUNT OF CLIENTS: " + std::to_string(clients->size()));
           
                             }
                             break;
                         }
 
+                        //Channel messages are multicasted to the channel members only
+                        if(!toSend.ROUTE.channel.empty()){
+                            MulticastPacket(toSend, toSend.ROUTE.channel);
+                            continue;
+                        }
+
                         //If reached here, it means that whatever packet is there to send back, it must be broadcasted to all clients, not multicasted or sent directly to one client
                         BroadcastPacket(toSend);
 
@@ -329,7 +650,7 @@ PigeonPacket PigeonServer::BuildPacket(PIGEON_OPCODE opcode, const std::string &
     pkt.HEADER.OPCODE = opcode;
     pkt.PAYLOAD = payload;
     pkt.HEADER.CONTENT_LENGTH = pkt.PAYLOAD.size();
-    pkt.HEADER.TIME_STAMP = std::time(0);
+    pkt.HEADER.TIME_STAMP = Clock::Get().Now();
     pkt.HEADER.username = username;
     pkt.HEADER.HEADER_LENGTH = sizeof(std::time_t) +            
                                pkt.HEADER.username.length() + 1 +
@@ -341,9 +662,11 @@ PigeonPacket PigeonServer::BuildPacket(PIGEON_OPCODE opcode, const std::string &
 /**
  * @brief Builds a new packet using BuildPacket based on the recived packet.
  * @param recv Recived PigeonPacket.
+ * @param clientFD FD of the client that sent the packet.
+ * @param config Config snapshot the packet is processed with.
  */
 // TODO: ADD LOGS FOR EACH EDGE CASE
-PigeonPacket PigeonServer::ProcessPacket(PigeonPacket &recv, int clientFD)
+PigeonPacket PigeonServer::ProcessPacket(PigeonPacket &recv, int clientFD, const PigeonConfig &config)
 {
     PigeonPacket newPacket;
     Json::Reader reader;
@@ -364,7 +687,8 @@ PigeonPacket PigeonServer::ProcessPacket(PigeonPacket &recv, int clientFD)
     case CLIENT_HELLO:
         if (!recv.PAYLOAD.empty() && !recv.HEADER.username.empty())
         {
-            newPacket = BuildPacket(SERVER_HELLO, recv.HEADER.username, String::StringToBytes(R"({"ServerName":")" + m_data->GetData()["servername"].asString() + R"(","MOTD":")" + m_data->GetData()["MOTD"].asString() + +R"(","sizelimit":)" + std::to_string(m_data->GetData()["sizelimit"].asInt()) + R"(})"));
+            // Payload comes from the pre-serialized SERVER_HELLO frame
+            newPacket = BuildPacket(SERVER_HELLO, recv.HEADER.username, {});
             
             auto it = this->clients->find(clientFD);
 
@@ -374,24 +698,38 @@ PigeonPacket PigeonServer::ProcessPacket(PigeonPacket &recv, int clientFD)
                 break;
             }
 
-            logger->log(INFO, "CLIENT HELLO FROM: " + recv.HEADER.username + " STATUS: " + value["status"].asString());
+            LOGF(logger, INFO, "CLIENT HELLO FROM: {} STATUS: {}", recv.HEADER.username, value["status"].asString());
 
             if (it != clients->end())
             {
-                it->second->logTimestamp = std::time(0);
+                it->second->logTimestamp = Clock::Get().Now();
 
-                // Does username already exist?
+                // Does username already exist? Checked and taken under the lock so two clients cannot get the same one
                 bool exists = false;
-                for (auto &p : *this->clients)
                 {
-                    if (p.second->username == recv.HEADER.username)
-                        exists = true;
+                    std::lock_guard<std::mutex> lock(this->m_clientsMtx);
+
+                    // A client saying hello again gives up the name it had, FreeClient only releases the current one
+                    if (it->second->hasLogged)
+                    {
+                        auto previous = m_usernames.find(it->second->username);
+                        if (previous != m_usernames.end() && previous->second == clientFD)
+                            m_usernames.erase(previous);
+                    }
+
+                    exists = m_usernames.count(recv.HEADER.username) > 0;
+                    if (!exists)
+                    {
+                        m_usernames[recv.HEADER.username] = clientFD;
+                        it->second->username = recv.HEADER.username;
+                    }
+
+                    m_loggedCount.store(m_usernames.size(), std::memory_order_relaxed);
                 }
 
                 // On connection, status will be Online by default, if user does not specify it.
                 if (!exists)
                 {
-                    it->second->username = recv.HEADER.username;
 
                     if (value["status"].asString() == "ONLINE")
                     {
@@ -407,12 +745,16 @@ PigeonPacket PigeonServer::ProcessPacket(PigeonPacket &recv, int clientFD)
                     }
                     
                     it->second->hasLogged = true;
+
+                    // Every client starts in the default channel, TEXT_MESSAGE and MEDIA_FILE go there unless told otherwise
+                    std::lock_guard<std::mutex> lock(this->m_clientsMtx);
+                    JoinChannel(clientFD, DEFAULT_CHANNEL);
                 }
                 else
                 {
                     newPacket = BuildPacket(USER_COLLISION, recv.HEADER.username, {});
 
-                    logger->log(ERROR, "USER COLLISION: " + recv.HEADER.username + " IS ALREADY USED");
+                    LOG(logger, ERROR, "USER COLLISION: " + recv.HEADER.username + " IS ALREADY USED");
                 }
 
                 // Username max length check
@@ -420,7 +762,7 @@ PigeonPacket PigeonServer::ProcessPacket(PigeonPacket &recv, int clientFD)
                 {
                     newPacket = BuildPacket(LENGTH_EXCEEDED, recv.HEADER.username, {});
 
-                    logger->log(ERROR, "USERNAME LENGTH EXCEEDED: " + recv.HEADER.username);
+                    LOG(logger, ERROR, "USERNAME LENGTH EXCEEDED: " + recv.HEADER.username);
                 }
             }
         }
@@ -444,7 +786,7 @@ PigeonPacket PigeonServer::ProcessPacket(PigeonPacket &recv, int clientFD)
             // We can saftely assume that after a successfful CLIENT_HELLO, the clients fd has a valid username and is connected
             // So we need to check if the FD who sent the packet has the same username thats contained in the packet itself.
 
-            logger->log(INFO, "TEXT MESSAGE BY: " + recv.HEADER.username + " " + std::string(recv.PAYLOAD.data(), recv.PAYLOAD.data() + recv.HEADER.CONTENT_LENGTH));
+            LOGF_THROTTLED(logger, INFO, LOG_PACKET_RATE, LOG_PACKET_BURST, "TEXT MESSAGE BY: {} {}", recv.HEADER.username, std::string_view(reinterpret_cast<const char *>(recv.PAYLOAD.data()), recv.HEADER.CONTENT_LENGTH));
 
             auto it = clients->find(clientFD);
 
@@ -453,12 +795,23 @@ PigeonPacket PigeonServer::ProcessPacket(PigeonPacket &recv, int clientFD)
                 // If both usernames match, we just need to verify the packets payload
                 if (recv.PAYLOAD.size() > 512)
                 {
-                    logger->log(WARNING, "TEXT MESSAGE TOO BIG: " + recv.HEADER.username);
+                    LOG(logger, WARNING, "TEXT MESSAGE TOO BIG: " + recv.HEADER.username);
 
                     newPacket = BuildPacket(LENGTH_EXCEEDED, recv.HEADER.username, {});
                     break;
                 }
+
+                {
+                    std::lock_guard<std::mutex> lock(this->m_clientsMtx);
+                    if (!IsInChannel(clientFD, DEFAULT_CHANNEL))
+                    {
+                        newPacket = BuildPacket(NOT_IN_CHANNEL, recv.HEADER.username, {});
+                        break;
+                    }
+                }
+
                 newPacket = BuildPacket(TEXT_MESSAGE, recv.HEADER.username, recv.PAYLOAD);
+                newPacket.ROUTE.channel = DEFAULT_CHANNEL;
             }
             else
             {
@@ -483,33 +836,33 @@ PigeonPacket PigeonServer::ProcessPacket(PigeonPacket &recv, int clientFD)
         if (!recv.PAYLOAD.empty() && !recv.HEADER.username.empty())
         {
 
-            logger->log(INFO, "NEW MEDIA FILE BY: " + recv.HEADER.username + " SIZE: " + std::to_string((recv.PAYLOAD.size() / (1000))) + " KB");
+            LOGF(logger, INFO, "NEW MEDIA FILE BY: {} SIZE: {} KB", recv.HEADER.username, recv.PAYLOAD.size() / 1000);
 
             auto it = clients->find(clientFD);
             if (it->second->username == recv.HEADER.username)
             {
 
-                if (recv.PAYLOAD.size() > m_data->GetData()["sizelimit"].asInt() * 1000 * 1000)
+                if ((long long)recv.PAYLOAD.size() > config.sizeLimitBytes)
                 {
 
-                    logger->log(ERROR, "MEDIA FILE TOO BIG: " + recv.HEADER.username);
+                    LOG(logger, ERROR, "MEDIA FILE TOO BIG: " + recv.HEADER.username);
                     newPacket = BuildPacket(LENGTH_EXCEEDED, recv.HEADER.username, {});
                     break;
                 }
 
-                if (std::time(0) - it->second->logTimestamp < m_data->GetData()["ratelimit"].asInt())
+                if (Clock::Get().Now() - it->second->logTimestamp < config.rateLimit)
                 {
                     newPacket = BuildPacket(RATE_LIMITED, recv.HEADER.username, {});
 
-                    logger->log(ERROR, "RATE LIMITED: " + recv.HEADER.username);
+                    LOG(logger, ERROR, "RATE LIMITED: " + recv.HEADER.username);
                     break;
                 }
 
-                it->second->logTimestamp = std::time(0);
+                it->second->logTimestamp = Clock::Get().Now();
                 if (!reader.parse(std::string(recv.PAYLOAD.begin(), recv.PAYLOAD.end()), value))
                 {
 
-                    logger->log(ERROR, "MALFORMED MEDIA PACKET: " + recv.HEADER.username);
+                    LOG(logger, ERROR, "MALFORMED MEDIA PACKET: " + recv.HEADER.username);
                     newPacket = BuildPacket(JSON_NOT_VALID, recv.HEADER.username, {});
                     break;
                 }
@@ -517,29 +870,64 @@ PigeonPacket PigeonServer::ProcessPacket(PigeonPacket &recv, int clientFD)
                 std::string fileContent = "";
                 std::string fileExt = "";
                 std::string fileName = "";
+                std::string channel = DEFAULT_CHANNEL;
 
                 fileContent = value["content"].asString();
                 fileExt = value["ext"].asString();
                 fileName = value["filename"].asString();
 
+                if (value.isMember("channel"))
+                    channel = value["channel"].asString();
+
                 // std::cout << fileExt << fileName << std::endl;
 
-                if (fileContent == "" || fileName == "")
+                std::time_t uploadTime = Clock::Get().Now();
+
+                if (fileContent == "" || !MediaStore::IsValidUploadName(fileName, uploadTime) || !IsValidChannel(channel))
                 {
 
-                    logger->log(ERROR, "MALFORMED MEDIA PACKET: " + recv.HEADER.username);
+                    LOG(logger, ERROR, "MALFORMED MEDIA PACKET: " + recv.HEADER.username);
                     newPacket = BuildPacket(JSON_NOT_VALID, recv.HEADER.username, {});
                     break;
                 }
 
-                auto contentBuffer = String::StringToBytes(B64::base64_decode(fileContent));
-
-                //Mutual exlcusion using RAII locks
                 {
                     std::lock_guard<std::mutex> lock(this->m_clientsMtx);
-                    bool err = File::BufferToDisk(recv.PAYLOAD, ("Files/" + std::to_string(std::time(0)) + "_" + fileName + ".json"));
+                    if (!IsInChannel(clientFD, channel))
+                    {
+                        newPacket = BuildPacket(NOT_IN_CHANNEL, recv.HEADER.username, {});
+                        break;
+                    }
                 }
-                newPacket = BuildPacket(MEDIA_FILE, recv.HEADER.username, String::StringToBytes(R"({"filename":")" + fileName + R"(", "ext":")" + fileExt + R"("})"));
+
+                // Stored once per content hash, the name is what clients use to download it
+                std::string storedName = "";
+
+                // Written by the upload pool while this thread waits, downloads are read by their own pool and never queue behind it
+                storedName = m_ioUpload->Submit([this, &fileName, &fileExt, &fileContent, uploadTime, &recv]
+                {
+                    return m_media.Store(fileName, fileExt, fileContent, uploadTime, recv.HEADER.username);
+                }).get();
+
+                // Only the sender hears about it, the channel never sees a file nobody can download
+                if (storedName.empty())
+                {
+                    LOG(logger, ERROR, "ERROR WHILE STORING MEDIA FILE BY: " + recv.HEADER.username);
+                    newPacket = BuildPacket(STORE_FAILED, recv.HEADER.username, {});
+                    break;
+                }
+
+                Json::Value notice;
+                notice["filename"] = fileName;
+                notice["ext"] = fileExt;
+                notice["channel"] = channel;
+                notice["name"] = storedName;
+
+                Json::StreamWriterBuilder builder;
+                builder["indentation"] = "";
+
+                newPacket = BuildPacket(MEDIA_FILE, recv.HEADER.username, String::StringToBytes(Json::writeString(builder, notice)));
+                newPacket.ROUTE.channel = channel;
             }
             else
             {
@@ -560,7 +948,7 @@ PigeonPacket PigeonServer::ProcessPacket(PigeonPacket &recv, int clientFD)
     */
     case MEDIA_DOWNLOAD:
 
-        logger->log(INFO, "NEW MEDIA DOWNLOAD REQUEST BY: " + recv.HEADER.username);
+        LOGF_THROTTLED(logger, INFO, LOG_PACKET_RATE, LOG_PACKET_BURST, "NEW MEDIA DOWNLOAD REQUEST BY: {}", recv.HEADER.username);
 
         if (!recv.PAYLOAD.empty() && !recv.HEADER.username.empty())
         {
@@ -574,16 +962,16 @@ PigeonPacket PigeonServer::ProcessPacket(PigeonPacket &recv, int clientFD)
             }
 
 
-            if (std::time(0) - it->second->logTimestamp < m_data->GetData()["ratelimit"].asInt())
+            if (Clock::Get().Now() - it->second->logTimestamp < config.rateLimit)
             {
                 newPacket = BuildPacket(RATE_LIMITED, recv.HEADER.username, {});
 
-                logger->log(ERROR, "RATE LIMITED: " + recv.HEADER.username);
+                LOG(logger, ERROR, "RATE LIMITED: " + recv.HEADER.username);
 
                 break;
             }
 
-            it->second->logTimestamp = std::time(0);
+            it->second->logTimestamp = Clock::Get().Now();
 
             if (!reader.parse(std::string(recv.PAYLOAD.begin(), recv.PAYLOAD.end()), value))
             {
@@ -598,27 +986,54 @@ PigeonPacket PigeonServer::ProcessPacket(PigeonPacket &recv, int clientFD)
             if (filename == "")
             {
 
-                logger->log(ERROR, "MALFORMED DOWNLOAD REQUEST: " + recv.HEADER.username);
+                LOG(logger, ERROR, "MALFORMED DOWNLOAD REQUEST: " + recv.HEADER.username);
 
                 newPacket = BuildPacket(JSON_NOT_VALID, recv.HEADER.username, {});
                 break;
             }
 
-            //verify filename later in case of path traversal but it wont really happen
-            std::vector<unsigned char> buffer;
+            // Popular files are served from the cache as ready to send frames. Files too big for the cache are
+            // sent straight from their mapping, the loader hands the already opened file over so it is not opened twice
+            std::shared_ptr<const MediaFile> media = nullptr;
+
+            auto frame = m_mediaCache.GetOrLoad(filename, [this, &filename, &media]() -> std::shared_ptr<const FrameTemplate>
             {
-                std::lock_guard<std::mutex> lock(this->m_clientsMtx);
-                buffer = File::DiskToBuffer("Files/" + filename + ".json");
+                // Read by the I/O pool. MediaStore rejects names that could escape the Files directory, no lock needed, blobs are immutable and mapped read only
+                return m_io->Submit([this, &filename, &media]() -> std::shared_ptr<const FrameTemplate>
+                {
+                    media = m_media.Open(filename);
+
+                    if (!media || media->Size() > m_mediaCache.MaxEntry())
+                        return nullptr;
+
+                    return std::make_shared<const FrameTemplate>(ACK_MEDIA_DOWNLOAD, std::initializer_list<std::string_view>{
+                        media->prefix,
+                        media->content,
+                        media->suffix});
+                }).get();
+            });
+
+            if (frame)
+            {
+                newPacket = BuildPacket(ACK_MEDIA_DOWNLOAD, recv.HEADER.username, {});
+                newPacket.FRAME = std::move(frame);
+                break;
             }
 
-            if (buffer.empty())
+            // Another thread loaded it but did not cache it, or it was never opened
+            if (!media)
+                media = m_io->Submit([this, &filename] { return m_media.Open(filename); }).get();
+
+            if (!media)
             {
-                logger->log(WARNING, "FILE NOT FOUND: " + recv.HEADER.username);
+                LOG(logger, WARNING, "FILE NOT FOUND: " + recv.HEADER.username);
                 newPacket = BuildPacket(FILE_NOT_FOUND, recv.HEADER.username, {});
                 break;
             }
 
-            newPacket = BuildPacket(ACK_MEDIA_DOWNLOAD, recv.HEADER.username, buffer);
+            newPacket = BuildPacket(ACK_MEDIA_DOWNLOAD, recv.HEADER.username, {});
+            newPacket.HEADER.CONTENT_LENGTH = media->Size();
+            newPacket.MEDIA = std::move(media);
         }
         else
         {
@@ -638,7 +1053,7 @@ PigeonPacket PigeonServer::ProcessPacket(PigeonPacket &recv, int clientFD)
         if (!recv.HEADER.username.empty())
         {
 
-            logger->log(INFO, "NEW PRESENCE REQUEST BY: " + recv.HEADER.username);
+            LOGF_THROTTLED(logger, INFO, LOG_PACKET_RATE, LOG_PACKET_BURST, "NEW PRESENCE REQUEST BY: {}", recv.HEADER.username);
 
             auto it = clients->find(clientFD);
 
@@ -667,7 +1082,7 @@ PigeonPacket PigeonServer::ProcessPacket(PigeonPacket &recv, int clientFD)
         if (!recv.PAYLOAD.empty() && !recv.HEADER.username.empty())
         {
 
-            logger->log(INFO, "NEW PRESENCE UPDATE REQUEST BY: " + recv.HEADER.username);
+            LOGF_THROTTLED(logger, INFO, LOG_PACKET_RATE, LOG_PACKET_BURST, "NEW PRESENCE UPDATE REQUEST BY: {}", recv.HEADER.username);
 
             auto it = this->clients->find(clientFD);
 
@@ -704,6 +1119,154 @@ PigeonPacket PigeonServer::ProcessPacket(PigeonPacket &recv, int clientFD)
         }
         break;
     /*
+    * Direct message to one user
+    * Verify payload/username
+    * Bad json check, payload must have to and content fields
+    * Check txt message length
+    * Recipient is looked up when sending, if offline the sender gets USER_OFFLINE
+    */
+    case DIRECT_MESSAGE:
+        if (!recv.PAYLOAD.empty() && !recv.HEADER.username.empty())
+        {
+            auto it = this->clients->find(clientFD);
+
+            if (it->second->username != recv.HEADER.username)
+            {
+                newPacket = BuildPacket(USERNAME_MISMATCH, recv.HEADER.username, {});
+                break;
+            }
+
+            if (!reader.parse(std::string(recv.PAYLOAD.begin(), recv.PAYLOAD.end()), value) || !value.isObject() || !value["to"].isString() || !value["content"].isString() || value["to"].asString().empty())
+            {
+                newPacket = BuildPacket(JSON_NOT_VALID, recv.HEADER.username, {});
+                break;
+            }
+
+            if (value["content"].asString().size() > 512)
+            {
+                LOG(logger, WARNING, "DIRECT MESSAGE TOO BIG: " + recv.HEADER.username);
+                newPacket = BuildPacket(LENGTH_EXCEEDED, recv.HEADER.username, {});
+                break;
+            }
+
+            LOGF_THROTTLED(logger, INFO, LOG_PACKET_RATE, LOG_PACKET_BURST, "DIRECT MESSAGE BY: {} TO {}", recv.HEADER.username, value["to"].asString());
+
+            newPacket = BuildPacket(DIRECT_MESSAGE, recv.HEADER.username, recv.PAYLOAD);
+            newPacket.ROUTE.recipient = value["to"].asString();
+        }
+        else
+        {
+            newPacket = BuildPacket(PROTOCOL_MISMATCH, recv.HEADER.username, {});
+        }
+        break;
+
+    /*
+    * Channel join/leave request
+    * Verify payload/username
+    * Bad json and channel name check
+    * Ack is only sent back to the client
+    */
+    case CHANNEL_JOIN:
+    case CHANNEL_LEAVE:
+        if (!recv.PAYLOAD.empty() && !recv.HEADER.username.empty())
+        {
+            auto it = this->clients->find(clientFD);
+
+            if (it->second->username != recv.HEADER.username)
+            {
+                newPacket = BuildPacket(USERNAME_MISMATCH, recv.HEADER.username, {});
+                break;
+            }
+
+            if (!reader.parse(std::string(recv.PAYLOAD.begin(), recv.PAYLOAD.end()), value) || !value.isObject() || !value["channel"].isString())
+            {
+                newPacket = BuildPacket(JSON_NOT_VALID, recv.HEADER.username, {});
+                break;
+            }
+
+            std::string channel = value["channel"].asString();
+
+            if (!IsValidChannel(channel))
+            {
+                LOG(logger, ERROR, "BAD CHANNEL NAME BY: " + recv.HEADER.username);
+                newPacket = BuildPacket(LENGTH_EXCEEDED, recv.HEADER.username, {});
+                break;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(this->m_clientsMtx);
+
+                if (recv.HEADER.OPCODE == CHANNEL_JOIN)
+                    JoinChannel(clientFD, channel);
+                else
+                    LeaveChannel(clientFD, channel);
+            }
+
+            LOGF(logger, INFO, "CHANNEL {} BY: {} {}", recv.HEADER.OPCODE == CHANNEL_JOIN ? "JOIN" : "LEAVE", recv.HEADER.username, channel);
+
+            newPacket = BuildPacket(recv.HEADER.OPCODE, recv.HEADER.username, String::StringToBytes(R"({"channel":")" + channel + R"("})"));
+            newPacket.ROUTE.channel = channel;
+        }
+        else
+        {
+            newPacket = BuildPacket(PROTOCOL_MISMATCH, recv.HEADER.username, {});
+        }
+        break;
+
+    /*
+    * Message to a channel
+    * Verify payload/username
+    * Bad json check, payload must have channel and content fields
+    * Check txt message length
+    * Sender must be a member of the channel
+    */
+    case CHANNEL_MESSAGE:
+        if (!recv.PAYLOAD.empty() && !recv.HEADER.username.empty())
+        {
+            auto it = this->clients->find(clientFD);
+
+            if (it->second->username != recv.HEADER.username)
+            {
+                newPacket = BuildPacket(USERNAME_MISMATCH, recv.HEADER.username, {});
+                break;
+            }
+
+            if (!reader.parse(std::string(recv.PAYLOAD.begin(), recv.PAYLOAD.end()), value) || !value.isObject() || !value["channel"].isString() || !value["content"].isString())
+            {
+                newPacket = BuildPacket(JSON_NOT_VALID, recv.HEADER.username, {});
+                break;
+            }
+
+            std::string channel = value["channel"].asString();
+
+            if (value["content"].asString().size() > 512)
+            {
+                LOG(logger, WARNING, "CHANNEL MESSAGE TOO BIG: " + recv.HEADER.username);
+                newPacket = BuildPacket(LENGTH_EXCEEDED, recv.HEADER.username, {});
+                break;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(this->m_clientsMtx);
+                if (!IsInChannel(clientFD, channel))
+                {
+                    newPacket = BuildPacket(NOT_IN_CHANNEL, recv.HEADER.username, {});
+                    break;
+                }
+            }
+
+            LOGF_THROTTLED(logger, INFO, LOG_PACKET_RATE, LOG_PACKET_BURST, "CHANNEL MESSAGE BY: {} TO {}", recv.HEADER.username, channel);
+
+            newPacket = BuildPacket(CHANNEL_MESSAGE, recv.HEADER.username, recv.PAYLOAD);
+            newPacket.ROUTE.channel = channel;
+        }
+        else
+        {
+            newPacket = BuildPacket(PROTOCOL_MISMATCH, recv.HEADER.username, {});
+        }
+        break;
+
+    /*
     * If opcode doesnt match any opcode then it must be bad packet/other protocol
     *
      */
@@ -717,11 +1280,12 @@ PigeonPacket PigeonServer::ProcessPacket(PigeonPacket &recv, int clientFD)
 /**
  * @brief Read incoming packet from a valid SSL/TLS connection.
  * @param ssl1 SSL/TLS connection from an active client.
+ * @param started If set, gets the Metrics::Now() at which the first bytes of the packet arrived.
  * 
  * If a emtpy vector is returned, the connection with the client will be closed
  */
 // Packet is 4 bytes + 8 bytes + 1 byte + username (max 20 chars == 20 bytes) + 1 byte null char + 4 bytes payload size + payload ( max 256 MB)
-std::vector<unsigned char> PigeonServer::ReadPacket(SSL *ssl1)
+std::vector<unsigned char> PigeonServer::ReadPacket(SSL *ssl1, uint64_t *started)
 {
     std::vector<unsigned char> packetBuffer(MAX_HEADER);
 
@@ -733,6 +1297,10 @@ std::vector<unsigned char> PigeonServer::ReadPacket(SSL *ssl1)
         return {};
     }
 
+    // Time spent waiting for the client to start a packet is not part of it
+    if (started != nullptr)
+        *started = Metrics::Now();
+
     // HUGE bug here when trying to recv huge files
     int headerLength = 0;
 
@@ -748,7 +1316,7 @@ std::vector<unsigned char> PigeonServer::ReadPacket(SSL *ssl1)
 
     if (headerLength > MAX_HEADER)
     {
-        logger->log(ERROR, "PACKET HEADER TOO BIG");
+        LOG(logger, ERROR, "PACKET HEADER TOO BIG");
 
         return {};
     }
@@ -764,7 +1332,7 @@ std::vector<unsigned char> PigeonServer::ReadPacket(SSL *ssl1)
     }
 
     if(payloadLength >= 256*1000*1000){
-        logger->log(ERROR, "PAYLOAD TOO BIG");
+        LOG(logger, ERROR, "PAYLOAD TOO BIG");
         return {};
     }
 
@@ -795,13 +1363,116 @@ void *PigeonServer::BroadcastPacket(const PigeonPacket &packet)
         for (auto &c : *clients)
         {
             clientsStr += std::to_string(c.first) + " ";
-            sent += SendAll(packetToSend, c.second->clientSsl);
+            sent += SendAll(packetToSend, *c.second);
         }
-        this->logger->log(DEBUG, "BROADCASTED " + std::to_string(sent) + " BYTES");
+        LOGF_SAMPLED(this->logger, DEBUG, 16, "BROADCASTED {} BYTES", sent);
     }
     return nullptr;
 }
 
+/**
+ * @brief Sends a packet whose payload comes from the media store. Cached frames only need their header rendered,
+ * otherwise the header and json prefix go in one write and the blob is written straight from its mapping.
+ * @param packet Packet with FRAME or MEDIA set, with MEDIA CONTENT_LENGTH must already be the media size.
+ * @param client Client to send it to.
+ * @return Bytes sent.
+ */
+int PigeonServer::SendMedia(const PigeonPacket &packet, Client &client)
+{
+    // The frame takes several writes, nothing else may go to this client in between
+    std::lock_guard<std::recursive_mutex> sendLock(client.sendMtx);
+
+    if (packet.FRAME)
+    {
+        auto head = packet.FRAME->RenderHeader(packet.HEADER.username, packet.HEADER.TIME_STAMP);
+        int sent = SendAll(head, client);
+        return sent + SendAll(packet.FRAME->Tail().data(), packet.FRAME->Tail().size(), client);
+    }
+
+    if (!packet.MEDIA)
+    {
+        auto bufToSend = SerializePacket(packet);
+        return SendAll(bufToSend, client);
+    }
+
+    auto head = SerializePacket(packet);
+    head.insert(head.end(), packet.MEDIA->prefix.begin(), packet.MEDIA->prefix.end());
+
+    int sent = SendAll(head, client);
+    sent += SendAll(reinterpret_cast<const unsigned char *>(packet.MEDIA->content.data()), packet.MEDIA->content.size(), client);
+    sent += SendAll(reinterpret_cast<const unsigned char *>(packet.MEDIA->suffix.data()), packet.MEDIA->suffix.size(), client);
+
+    return sent;
+}
+
+/**
+ * @brief Sends a PigeonPacket to the members of a channel only and records it in the channel history. Packet is serialized once for all of them.
+ * @param packet Packet to sent.
+ * @param channel Channel the packet is sent to.
+ */
+void PigeonServer::MulticastPacket(const PigeonPacket &packet, const std::string &channel)
+{
+    auto packetToSend = SerializePacket(packet);
+
+    // Members are copied under the registry lock and sent to outside it, so a slow member only holds back this fanout.
+    // A member freed meanwhile is skipped by SendAll
+    std::vector<std::shared_ptr<Client>> members;
+    {
+        std::lock_guard<std::mutex> lock(this->m_clientsMtx);
+
+        auto ch = m_channels.find(channel);
+        if (ch != m_channels.end())
+        {
+            members.reserve(ch->second.size());
+            for (int fd : ch->second)
+            {
+                auto it = clients->find(fd);
+                if (it != clients->end())
+                    members.push_back(it->second);
+            }
+        }
+    }
+
+    int sent = 0;
+    for (auto &member : members)
+        sent += SendAll(packetToSend, *member);
+
+    LOGF_SAMPLED(this->logger, DEBUG, 16, "MULTICASTED {} BYTES TO {}", sent, channel);
+
+    // Recorded after the fanout, so members never wait on the history commit
+    m_history.Append(channel, packetToSend);
+}
+
+/**
+ * @brief Sends a PigeonPacket to a single logged client, looked up by username.
+ * @param packet Packet to sent.
+ * @param recipient Username of the client.
+ * @return False if the recipient is not online.
+ */
+bool PigeonServer::UnicastPacket(const PigeonPacket &packet, const std::string &recipient)
+{
+    auto packetToSend = SerializePacket(packet);
+
+    // Looked up under the registry lock and sent to outside it, like a channel fanout
+    std::shared_ptr<Client> target;
+    {
+        std::lock_guard<std::mutex> lock(this->m_clientsMtx);
+
+        auto name = m_usernames.find(recipient);
+        if (name == m_usernames.end())
+            return false;
+
+        auto it = clients->find(name->second);
+        if (it == clients->end())
+            return false;
+
+        target = it->second;
+    }
+
+    SendAll(packetToSend, *target);
+    return true;
+}
+
 /**
  * @brief Sends a PigeonPacket to all connected clients.
  * @param packet Packet to sent.
@@ -27,6 +27,13 @@
 #include <iomanip>
 #include <regex>
 #include <mutex>
+#include <unordered_set>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/inotify.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/ioprio.h>
 
 #include <openssl/ssl.h>
 #include <openssl/err.h>
@@ -34,6 +41,14 @@
 
 #include "../TcpServer/TcpServer.h"
 #include "PigeonPacket.h"
+#include "PigeonFrame.h"
+#include "MediaStore.h"
+#include "MediaCache.h"
+#include "IoPool.h"
+#include "History.h"
+#include "PacketCapture.h"
+#include "Metrics.h"
+#include "StatsServer.h"
 #include "Utils.h"
 #include "../Logger/Logger/Logger.h"
 #include <thread>
@@ -53,13 +68,19 @@ enum Status
 struct Client
 {
     std::string ipv4;
+    // Freed and set to nullptr by FreeClient under sendMtx, other threads may still hold the Client
     SSL *clientSsl;
     std::time_t logTimestamp;
     std::string username;
     Status status;
     bool hasLogged = false;
+    std::unordered_set<std::string> channels;
 
-    Client() : clientSsl(nullptr), logTimestamp(std::time(0)), username(""), status(ONLINE), ipv4(""){};
+    // Held for every write to clientSsl so frames sent from different threads never interleave. Recursive so a
+    // multi write frame (SendMedia) can hold it across its SendAll calls
+    std::recursive_mutex sendMtx;
+
+    Client() : clientSsl(nullptr), logTimestamp(Clock::Get().Now()), username(""), status(ONLINE), ipv4(""){};
 };
 
 /**
@@ -89,41 +110,67 @@ public:
 public:
     void Run();
 
-    std::vector<unsigned char> ReadPacket(SSL *ssl1);
-    PigeonPacket ProcessPacket(PigeonPacket &recv, int clientFD);
+    std::vector<unsigned char> ReadPacket(SSL *ssl1, uint64_t *started = nullptr);
+    PigeonPacket ProcessPacket(PigeonPacket &recv, int clientFD, const PigeonConfig &config);
 
     std::vector<unsigned char> SerializePacket(const PigeonPacket &packet);
     PigeonPacket DeserializePacket(std::vector<unsigned char> &packet);
 
     PigeonPacket BuildPacket(PIGEON_OPCODE opcode, const std::string &username, const std::vector<unsigned char> &payload);
 
+    std::shared_ptr<const ResponseFrames> BuildFrames(std::shared_ptr<const PigeonConfig> config);
+    std::vector<unsigned char> SerializeResponse(const PigeonPacket &packet, const ResponseFrames &frames);
+
     void* BroadcastPacket(const PigeonPacket &packet);
+    int SendMedia(const PigeonPacket &packet, Client &client);
+
+    inline MediaCache &GetMediaCache()
+    {
+        return m_mediaCache;
+    }
+    void MulticastPacket(const PigeonPacket &packet, const std::string &channel);
+    bool UnicastPacket(const PigeonPacket &packet, const std::string &recipient);
 
     void NotifyNewPresence();
 
+    void WatchConfig();
+    void ReloadConfig();
+
+    /*
+        Hide TcpServer::SendAll so every write to a client is counted. Nothing is written once FreeClient released the connection
+    */
+    inline int SendAll(const std::vector<unsigned char> &buf, Client &client)
+    {
+        return SendAll(buf.data(), buf.size(), client);
+    }
+
+    inline int SendAll(const unsigned char *buf, size_t size, Client &client)
+    {
+        std::lock_guard<std::recursive_mutex> sendLock(client.sendMtx);
+        if (client.clientSsl == nullptr)
+            return 0;
+
+        int sent = TcpServer::SendAll(buf, size, client.clientSsl);
+        Metrics::Get().Add(MetricCounter::WRITES_OUT);
+        Metrics::Get().Add(MetricCounter::BYTES_OUT, sent);
+        return sent;
+    }
+
     // UTILS
 public:
-    inline std::unordered_map<int, Client *> *GetClients()
+    inline std::unordered_map<int, std::shared_ptr<Client>> *GetClients()
     {
         return this->clients;
     }
 
     inline std::string GetDate()
     {
-        auto now = std::chrono::system_clock::now();
-        std::time_t currentTime = std::chrono::system_clock::to_time_t(now);
-
-        std::string time = std::string(std::ctime(&currentTime));
-        size_t pos = time.find('\n');
-        if (pos != std::string::npos)
-        {
-            time.erase(pos);
-        }
-        return time;
+        return Clock::Get().LogTime();
     }
 
     /*
-        Properly frees a client by its FD
+        Properly frees a client by its FD, m_clientsMtx must be held. The connection is released here, the Client itself
+        goes with the last handle to it
     */
     inline void FreeClient(int c)
     {
@@ -131,20 +178,49 @@ public:
         auto it = clients->find(c);
         if (it != clients->end())
         {
-            SSL_free(it->second->clientSsl);
-            it->second->clientSsl = nullptr;
-            delete it->second;
+            for (auto &channel : it->second->channels)
+            {
+                auto ch = m_channels.find(channel);
+                if (ch != m_channels.end())
+                {
+                    ch->second.erase(c);
+                    if (ch->second.empty())
+                        m_channels.erase(ch);
+                }
+            }
+
+            auto name = m_usernames.find(it->second->username);
+            if (name != m_usernames.end() && name->second == c)
+                m_usernames.erase(name);
+
+            {
+                // Waits for a write in flight, the socket is already shut down so it fails right away
+                std::lock_guard<std::recursive_mutex> sendLock(it->second->sendMtx);
+                SSL_free(it->second->clientSsl);
+                it->second->clientSsl = nullptr;
+            }
+
+            // Closed only now, a sender still holding the Client cannot write to a new connection reusing the FD
+            close(c);
             clients->erase(it);
+            m_clientCount.store(clients->size(), std::memory_order_relaxed);
+            m_loggedCount.store(m_usernames.size(), std::memory_order_relaxed);
         }
         
     };
 
 
-    inline void DisconnectClient(int c,SSL *cSSL)
-    {   
-        SSL_shutdown(cSSL);
+    /*
+        Shuts the connection down, which wakes its thread. The FD is closed by FreeClient
+    */
+    inline void DisconnectClient(int c, Client &client)
+    {
+        // A writer blocked on a slow reader holds the send lock, that connection goes without a close_notify
+        std::unique_lock<std::recursive_mutex> sendLock(client.sendMtx, std::try_to_lock);
+        if (sendLock.owns_lock() && client.clientSsl != nullptr)
+            SSL_shutdown(client.clientSsl);
+
         shutdown(c, SHUT_RDWR);
-        close(c);
     }
 
     inline bool CheckIp(const std::string &ipv4)
@@ -159,6 +235,54 @@ public:
         return false;
     }
 
+    /*
+        Channel membership, m_clientsMtx must be held by the caller
+    */
+    inline void JoinChannel(int c, const std::string &channel)
+    {
+        auto it = clients->find(c);
+        if (it != clients->end())
+        {
+            m_channels[channel].insert(c);
+            it->second->channels.insert(channel);
+        }
+    }
+
+    inline void LeaveChannel(int c, const std::string &channel)
+    {
+        auto ch = m_channels.find(channel);
+        if (ch != m_channels.end())
+        {
+            ch->second.erase(c);
+            if (ch->second.empty())
+                m_channels.erase(ch);
+        }
+
+        auto it = clients->find(c);
+        if (it != clients->end())
+            it->second->channels.erase(channel);
+    }
+
+    inline bool IsInChannel(int c, const std::string &channel)
+    {
+        auto ch = m_channels.find(channel);
+        return ch != m_channels.end() && ch->second.count(c) > 0;
+    }
+
+    // Channel names are sent back inside json payloads, so only a safe charset is allowed
+    inline bool IsValidChannel(const std::string &channel)
+    {
+        if (channel.empty() || channel.length() > MAX_CHANNEL)
+            return false;
+
+        for (char ch : channel)
+        {
+            if (!std::isalnum(static_cast<unsigned char>(ch)) && ch != '_' && ch != '-')
+                return false;
+        }
+        return true;
+    }
+
     //Not  used
     inline bool isBase64(const std::string &str)
     {
@@ -170,9 +294,29 @@ private:
     std::string serverName = "";
     Logger *logger = nullptr;
     PigeonData* m_data = nullptr;
+    std::atomic<std::shared_ptr<const ResponseFrames>> m_frames;
+    MediaStore m_media{"Files"};
+    MediaCache m_mediaCache{0};
+    // Downloads and uploads, apart so a download never queues behind an upload waiting for its fdatasync
+    std::unique_ptr<IoPool> m_io;
+    std::unique_ptr<IoPool> m_ioUpload;
+    History m_history{"Files/history.log", 50};
+    std::unique_ptr<PacketCapture> m_capture;
+    std::unique_ptr<StatsServer> m_stats;
 
 private:
-    std::unordered_map<int, Client *> *clients;
+    // Shared with the senders that copied a handle, so a Client outlives its entry while they write to it
+    std::unordered_map<int, std::shared_ptr<Client>> *clients;
     std::mutex m_clientsMtx;
 
+    // Username to FD of every logged client, guarded by m_clientsMtx
+    std::unordered_map<std::string, int> m_usernames;
+
+    // Channel name to member FDs, guarded by m_clientsMtx
+    std::unordered_map<std::string, std::unordered_set<int>> m_channels;
+
+    // Sizes of clients and m_usernames, readable without m_clientsMtx
+    std::atomic<size_t> m_clientCount{0};
+    std::atomic<size_t> m_loggedCount{0};
+
 };
@@ -0,0 +1,172 @@
+#include "SegmentStore.h"
+
+#include <filesystem>
+
+SegmentStore::SegmentStore(const std::string &dir) : m_dir(dir)
+{
+    namespace fs = std::filesystem;
+    std::error_code ec;
+
+    fs::create_directories(m_dir, ec);
+
+    for (auto &dirEntry : fs::directory_iterator(m_dir, ec))
+    {
+        if (!dirEntry.is_regular_file() || dirEntry.path().extension() != ".seg")
+            continue;
+
+        int64_t segment = std::atoll(dirEntry.path().stem().c_str());
+        m_sizes[segment] = dirEntry.file_size();
+    }
+
+    // Keeps appending to the last segment after a restart, whatever was torn at its end is not referenced by the index
+    if (m_sizes.empty())
+    {
+        Roll();
+    }
+    else
+    {
+        m_active = m_sizes.rbegin()->first;
+        m_activeFd = open(Path(m_active).c_str(), O_WRONLY | O_CLOEXEC);
+    }
+}
+
+SegmentStore::~SegmentStore()
+{
+    if (m_activeFd >= 0)
+        close(m_activeFd);
+}
+
+/**
+ * @brief Appends a blob to the active segment, starting a new one if it would not fit.
+ * @param data Blob content.
+ * @param location Filled with where the blob was written.
+ * @return False on write error.
+ */
+bool SegmentStore::Append(std::string_view data, BlobLocation &location)
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+
+    if (m_activeFd < 0 || (m_sizes[m_active] > 0 && m_sizes[m_active] + data.size() > SEGMENT_SIZE))
+    {
+        if (!Roll())
+            return false;
+    }
+
+    uint64_t offset = m_sizes[m_active];
+    size_t written = 0;
+
+    while (written < data.size())
+    {
+        ssize_t n = pwrite(m_activeFd, data.data() + written, data.size() - written, offset + written);
+        if (n <= 0)
+            return false;
+        written += n;
+    }
+
+    m_sizes[m_active] += data.size();
+
+    location.segment = m_active;
+    location.offset = offset;
+    location.size = data.size();
+    return true;
+}
+
+/**
+ * @brief Mapping of a segment covering at least [0, end). The active segment keeps growing, so its mapping
+ * is replaced once a blob past its end is requested. Old mappings stay valid for whoever still holds them.
+ */
+std::shared_ptr<const File::MappedFile> SegmentStore::Map(int64_t segment, uint64_t end)
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+
+    auto it = m_maps.find(segment);
+    if (it != m_maps.end() && it->second->Size() >= end)
+        return it->second;
+
+    auto mapping = File::MappedFile::Open(Path(segment));
+
+    if (!mapping || mapping->Size() < end)
+        return nullptr;
+
+    m_maps[segment] = mapping;
+    return mapping;
+}
+
+/*
+    Deletes a segment once compaction moved its live blobs out
+*/
+void SegmentStore::Remove(int64_t segment)
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+
+    if (segment == m_active)
+        return;
+
+    m_maps.erase(segment);
+    m_sizes.erase(segment);
+    unlink(Path(segment).c_str());
+}
+
+int64_t SegmentStore::ActiveSegment()
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+    return m_active;
+}
+
+std::map<int64_t, uint64_t> SegmentStore::Segments()
+{
+    std::lock_guard<std::mutex> lock(m_mtx);
+    return m_sizes;
+}
+
+std::string SegmentStore::Path(int64_t segment) const
+{
+    return m_dir + "/" + std::to_string(segment) + ".seg";
+}
+
+/*
+    Flushes the active segment to disk. Segments before it were flushed when they were rolled
+*/
+bool SegmentStore::Sync()
+{
+    int fd = -1;
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+
+        if (m_activeFd < 0)
+            return true;
+
+        // Own descriptor, so a roll can close the active one while this one is flushing
+        fd = dup(m_activeFd);
+    }
+
+    if (fd < 0)
+        return false;
+
+    bool ok = fdatasync(fd) == 0;
+    close(fd);
+    return ok;
+}
+
+/*
+    Starts a new active segment. Segment mutex must be held
+*/
+bool SegmentStore::Roll()
+{
+    int64_t next = m_sizes.empty() ? 0 : m_sizes.rbegin()->first + 1;
+    int fd = open(Path(next).c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+
+    if (fd < 0)
+        return false;
+
+    if (m_activeFd >= 0)
+    {
+        fdatasync(m_activeFd);
+        close(m_activeFd);
+    }
+
+    m_active = next;
+    m_activeFd = fd;
+    m_sizes[next] = 0;
+    return true;
+}
@@ -0,0 +1,71 @@
+/*
+ *   @author jozese
+ *
+ *
+ *
+ */
+
+#pragma once
+
+#include "MediaIndex.h"
+#include "Utils.h"
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Blobs up to this size are packed into segments, bigger ones get their own file
+#ifndef SEGMENT_BLOB_MAX
+#define SEGMENT_BLOB_MAX (256 * 1024)
+#endif
+
+// A new segment is started once the active one would grow past this
+#ifndef SEGMENT_SIZE
+#define SEGMENT_SIZE (64 * 1024 * 1024)
+#endif
+
+/**
+ * @class SegmentStore
+ * @brief Append only segment files for small blobs.
+ *
+ * Blobs are appended to the active segment and addressed by (segment, offset, length), so thousands of
+ * small uploads end up in a handful of big files. Segments are never modified in place, compaction copies
+ * the live blobs of a mostly dead segment to the active one and then deletes it.
+ */
+class SegmentStore
+{
+public:
+    SegmentStore(const std::string &dir);
+    ~SegmentStore();
+
+    SegmentStore(const SegmentStore &) = delete;
+    SegmentStore &operator=(const SegmentStore &) = delete;
+
+public:
+    bool Append(std::string_view data, BlobLocation &location);
+    std::shared_ptr<const File::MappedFile> Map(int64_t segment, uint64_t end);
+    void Remove(int64_t segment);
+    bool Sync();
+
+    int64_t ActiveSegment();
+    std::map<int64_t, uint64_t> Segments();
+
+private:
+    std::string Path(int64_t segment) const;
+    bool Roll();
+
+private:
+    std::string m_dir = "";
+
+    std::mutex m_mtx;
+    int64_t m_active = -1;
+    int m_activeFd = -1;
+
+    // Segment id to its size in bytes
+    std::map<int64_t, uint64_t> m_sizes;
+    std::map<int64_t, std::shared_ptr<const File::MappedFile>> m_maps;
+};
@@ -0,0 +1,317 @@
+#include "StatsServer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Histogram buckets are rendered at powers of two ns from 2^10 (about 1 us) to 2^34 (about 17 s), they line up with Metrics buckets
+#define STATS_FIRST_EXPONENT 10
+#define STATS_LAST_EXPONENT 34
+
+static void Append(std::string &out, const char *format, ...)
+{
+    char line[512];
+
+    va_list args;
+    va_start(args, format);
+    int n = std::vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+
+    if (n > 0)
+        out.append(line, std::min<size_t>(n, sizeof(line) - 1));
+}
+
+StatsServer::StatsServer(unsigned short port) : m_port(port)
+{
+}
+
+StatsServer::~StatsServer()
+{
+    if (m_running.exchange(false))
+    {
+        // Wakes the thread blocked in accept
+        shutdown(m_socket, SHUT_RDWR);
+        m_thread.join();
+    }
+
+    if (m_socket != -1)
+        close(m_socket);
+}
+
+/**
+ * @brief Binds 127.0.0.1 on the port and starts serving.
+ * @return False if the port could not be bound.
+ */
+bool StatsServer::Start()
+{
+    m_socket = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (m_socket < 0)
+    {
+        m_socket = -1;
+        return false;
+    }
+
+    int reuse = 1;
+    setsockopt(m_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(m_port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (bind(m_socket, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || listen(m_socket, 16) != 0)
+        return false;
+
+    m_running.store(true);
+    m_thread = std::thread(&StatsServer::Serve, this);
+    return true;
+}
+
+void StatsServer::Serve()
+{
+    pthread_setname_np(pthread_self(), "pgn-stats");
+
+    while (m_running.load())
+    {
+        int client = accept4(m_socket, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client < 0)
+        {
+            // Out of fds or similar, do not spin on it
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            continue;
+        }
+
+        Answer(client);
+        close(client);
+    }
+}
+
+/*
+    Reads the request line and headers, answers GET /metrics with the metrics and anything else with a 404
+*/
+void StatsServer::Answer(int client)
+{
+    std::string request;
+    char buf[1024];
+
+    while (request.size() < STATS_MAX_REQUEST && request.find("\r\n\r\n") == std::string::npos)
+    {
+        pollfd fd{client, POLLIN, 0};
+        if (poll(&fd, 1, STATS_TIMEOUT_MS) <= 0)
+            return;
+
+        ssize_t n = recv(client, buf, sizeof(buf), 0);
+        if (n <= 0)
+            return;
+
+        request.append(buf, n);
+    }
+
+    std::string body;
+    std::string status = "200 OK";
+
+    if (request.rfind("GET /metrics ", 0) == 0 || request.rfind("GET / ", 0) == 0)
+        body = Render();
+    else
+    {
+        status = "404 Not Found";
+        body = "Not found, metrics are at /metrics\n";
+    }
+
+    std::string response = "HTTP/1.0 " + status + "\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " + std::to_string(body.size()) +
+                           "\r\nConnection: close\r\n\r\n" + body;
+
+    size_t sent = 0;
+    while (sent < response.size())
+    {
+        ssize_t n = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0)
+            return;
+        sent += n;
+    }
+}
+
+/**
+ * @brief Renders every metric in the Prometheus text exposition format.
+ */
+std::string StatsServer::Render()
+{
+    MetricsSnapshot snapshot = Metrics::Get().Collect();
+    std::string out;
+    out.reserve(64 * 1024);
+
+    struct Total
+    {
+        MetricCounter counter;
+        const char *name;
+        const char *help;
+    };
+
+    static const Total totals[] = {
+        {MetricCounter::PACKETS_IN, "pigeon_packets_in_total", "Packets read from clients"},
+        {MetricCounter::BYTES_IN, "pigeon_bytes_in_total", "Bytes of the packets read from clients"},
+        {MetricCounter::WRITES_OUT, "pigeon_writes_out_total", "Writes to clients"},
+        {MetricCounter::BYTES_OUT, "pigeon_bytes_out_total", "Bytes written to clients"},
+        {MetricCounter::CONNECTIONS, "pigeon_connections_total", "Accepted client connections"},
+    };
+
+    for (auto &total : totals)
+    {
+        Append(out, "# HELP %s %s\n# TYPE %s counter\n", total.name, total.help, total.name);
+        Append(out, "%s %llu\n", total.name, static_cast<unsigned long long>(snapshot.Get(total.counter)));
+    }
+
+    for (auto &watched : Metrics::Get().GetWatched())
+    {
+        Append(out, "# HELP %s %s\n# TYPE %s %s\n", watched.name.c_str(), watched.help.c_str(), watched.name.c_str(), watched.kind == MetricKind::COUNTER ? "counter" : "gauge");
+        Append(out, "%s %.17g\n", watched.name.c_str(), watched.read());
+    }
+
+    out += "# HELP pigeon_opcode_packets_total Packets read from clients by opcode\n# TYPE pigeon_opcode_packets_total counter\n";
+    for (int op = 0; op < 256; op++)
+    {
+        if (snapshot.opcodePackets[op] > 0)
+            Append(out, "pigeon_opcode_packets_total{opcode=\"%s\"} %llu\n", Metrics::OpcodeLabel(op).c_str(), static_cast<unsigned long long>(snapshot.opcodePackets[op]));
+    }
+
+    out += "# HELP pigeon_opcode_bytes_total Bytes of the packets read from clients by opcode\n# TYPE pigeon_opcode_bytes_total counter\n";
+    for (int op = 0; op < 256; op++)
+    {
+        if (snapshot.opcodePackets[op] > 0)
+            Append(out, "pigeon_opcode_bytes_total{opcode=\"%s\"} %llu\n", Metrics::OpcodeLabel(op).c_str(), static_cast<unsigned long long>(snapshot.opcodeBytes[op]));
+    }
+
+    constexpr int stages = static_cast<int>(MetricStage::COUNT);
+
+    out += "# HELP pigeon_packet_duration_seconds Time of a packet in each stage of its client thread\n# TYPE pigeon_packet_duration_seconds histogram\n";
+    for (auto &[key, histogram] : snapshot.histograms)
+    {
+        std::string label = Metrics::OpcodeLabel(key / stages);
+        const char *opcode = label.c_str();
+        const char *stage = Metrics::StageName(static_cast<MetricStage>(key % stages));
+
+        uint64_t cumulative = 0;
+        size_t bucket = 0;
+
+        for (int exponent = STATS_FIRST_EXPONENT; exponent <= STATS_LAST_EXPONENT; exponent++)
+        {
+            uint64_t bound = 1ULL << exponent;
+            for (; bucket < METRICS_BUCKETS && MetricsHistogram::UpperBound(bucket) <= bound; bucket++)
+                cumulative += histogram.buckets[bucket];
+
+            Append(out, "pigeon_packet_duration_seconds_bucket{opcode=\"%s\",stage=\"%s\",le=\"%.12g\"} %llu\n", opcode, stage, bound / 1e9,
+                   static_cast<unsigned long long>(cumulative));
+        }
+
+        Append(out, "pigeon_packet_duration_seconds_bucket{opcode=\"%s\",stage=\"%s\",le=\"+Inf\"} %llu\n", opcode, stage, static_cast<unsigned long long>(histogram.count));
+        Append(out, "pigeon_packet_duration_seconds_sum{opcode=\"%s\",stage=\"%s\"} %.9g\n", opcode, stage, histogram.sum / 1e9);
+        Append(out, "pigeon_packet_duration_seconds_count{opcode=\"%s\",stage=\"%s\"} %llu\n", opcode, stage, static_cast<unsigned long long>(histogram.count));
+    }
+
+    RenderThreads(out);
+    return out;
+}
+
+/*
+    Threads share the address space, so memory is reported for the process. CPU time and page faults are summed by
+    thread name: there is a thread per client, labelling them by tid would make a new series for every connection.
+    They are gauges, a thread that exits takes its share with it and the sum goes down.
+*/
+void StatsServer::RenderThreads(std::string &out)
+{
+    long ticks = sysconf(_SC_CLK_TCK);
+    long page = sysconf(_SC_PAGESIZE);
+
+    std::ifstream statm("/proc/self/statm");
+    unsigned long long virt = 0, resident = 0;
+    if (statm >> virt >> resident)
+    {
+        out += "# HELP pigeon_process_resident_memory_bytes Resident memory of the server\n# TYPE pigeon_process_resident_memory_bytes gauge\n";
+        Append(out, "pigeon_process_resident_memory_bytes %llu\n", resident * page);
+        out += "# HELP pigeon_process_virtual_memory_bytes Virtual memory of the server\n# TYPE pigeon_process_virtual_memory_bytes gauge\n";
+        Append(out, "pigeon_process_virtual_memory_bytes %llu\n", virt * page);
+    }
+
+    DIR *dir = opendir("/proc/self/task");
+    if (dir == nullptr)
+        return;
+
+    struct Usage
+    {
+        unsigned long long threads = 0;
+        unsigned long long ticks = 0;
+        unsigned long long minor = 0;
+        unsigned long long major = 0;
+    };
+
+    std::map<std::string, Usage> usage;
+
+    while (dirent *entry = readdir(dir))
+    {
+        if (entry->d_name[0] == '.')
+            continue;
+
+        std::ifstream file(std::string("/proc/self/task/") + entry->d_name + "/stat");
+        std::string stat;
+        if (!std::getline(file, stat))
+            continue;
+
+        // pid (comm) state ..., comm can hold spaces and parentheses
+        size_t open = stat.find('(');
+        size_t close = stat.rfind(')');
+        if (open == std::string::npos || close == std::string::npos || close < open)
+            continue;
+
+        std::string name = stat.substr(open + 1, close - open - 1);
+        for (char &ch : name)
+        {
+            if (ch == '"' || ch == '\\')
+                ch = '_';
+        }
+
+        // Fields after the comm, starting at field 3 (state)
+        std::istringstream fields(stat.substr(close + 2));
+        std::string field;
+        unsigned long long values[13] = {};
+        for (int i = 0; i < 13 && fields >> field; i++)
+            values[i] = std::strtoull(field.c_str(), nullptr, 10);
+
+        // minflt is field 10, majflt 12, utime 14 and stime 15
+        Usage &named = usage[name];
+        named.threads++;
+        named.minor += values[7];
+        named.major += values[9];
+        named.ticks += values[11] + values[12];
+    }
+
+    closedir(dir);
+
+    out += "# HELP pigeon_threads Live threads by name\n# TYPE pigeon_threads gauge\n";
+    for (auto &[name, named] : usage)
+        Append(out, "pigeon_threads{name=\"%s\"} %llu\n", name.c_str(), named.threads);
+
+    out += "# HELP pigeon_thread_cpu_seconds CPU time of the live threads by name\n# TYPE pigeon_thread_cpu_seconds gauge\n";
+    for (auto &[name, named] : usage)
+        Append(out, "pigeon_thread_cpu_seconds{name=\"%s\"} %.2f\n", name.c_str(), static_cast<double>(named.ticks) / ticks);
+
+    out += "# HELP pigeon_thread_page_faults Page faults of the live threads by name\n# TYPE pigeon_thread_page_faults gauge\n";
+    for (auto &[name, named] : usage)
+    {
+        Append(out, "pigeon_thread_page_faults{name=\"%s\",kind=\"minor\"} %llu\n", name.c_str(), named.minor);
+        Append(out, "pigeon_thread_page_faults{name=\"%s\",kind=\"major\"} %llu\n", name.c_str(), named.major);
+    }
+}
@@ -0,0 +1,55 @@
+/*
+ *   @author jozese
+ *
+ *
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include "Metrics.h"
+
+// Biggest request read from a scraper, anything past it is ignored
+#define STATS_MAX_REQUEST 4096
+
+// A scraper that does not send its request within this time is dropped
+#define STATS_TIMEOUT_MS 1000
+
+/**
+ * @class StatsServer
+ * @brief Plain TCP listener on 127.0.0.1 that serves the metrics in the Prometheus text format.
+ *
+ * It is separate from the TLS Pigeon port and only reachable from the host itself. Scrapes are served one at a
+ * time by a single thread. Rendering only reads the Metrics shards and the watched values, so a scrape never
+ * makes a client thread wait.
+ */
+class StatsServer
+{
+public:
+    StatsServer(unsigned short port);
+    ~StatsServer();
+
+    StatsServer(const StatsServer &) = delete;
+    StatsServer &operator=(const StatsServer &) = delete;
+
+public:
+    bool Start();
+
+    static std::string Render();
+
+private:
+    void Serve();
+    void Answer(int client);
+
+    static void RenderThreads(std::string &out);
+
+private:
+    unsigned short m_port = 0;
+    int m_socket = -1;
+    std::atomic<bool> m_running{false};
+    std::thread m_thread;
+};
@@ -4,24 +4,114 @@
 #include <fstream>
 #include <iterator>
 #include <sstream>
+#include <iomanip>
 #include <vector>
+#include <memory>
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 namespace File
 {
-    static bool BufferToDisk(const std::vector<unsigned char> &buffer, const std::string &filename)
+    static bool BufferToDisk(const char *data, size_t size, const std::string &filename)
     {
         std::ofstream outfile(filename, std::ios::out | std::ios::binary);
 
         if (outfile.is_open())
         {
-            outfile.write(reinterpret_cast<const char *>(buffer.data()), buffer.size());
+            outfile.write(data, size);
             outfile.close();
         }
         else
         {
             return false;
         }
-        return true;
+        return !outfile.fail();
+    }
+
+    static bool BufferToDisk(const std::vector<unsigned char> &buffer, const std::string &filename)
+    {
+        return BufferToDisk(reinterpret_cast<const char *>(buffer.data()), buffer.size(), filename);
+    }
+
+    // Chunk size of positional writes, a multiple of the O_DIRECT alignment
+    constexpr size_t WRITE_CHUNK = 1024 * 1024;
+    constexpr size_t DIRECT_ALIGN = 4096;
+
+    /*
+        Writes a whole buffer to a new file whose size is known up front. The file is preallocated with fallocate,
+        so concurrent big writes get contiguous extents, and filled with positional writes of WRITE_CHUNK bytes.
+        With direct set the data bypasses the page cache (O_DIRECT), falling back to buffered writes when the
+        filesystem does not support it. With sync set the data is flushed before returning.
+    */
+    inline bool PreallocatedWrite(const char *data, size_t size, const std::string &filename, bool direct, bool sync)
+    {
+        int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+        int fd = direct ? open(filename.c_str(), flags | O_DIRECT, 0644) : -1;
+
+        if (fd < 0)
+        {
+            direct = false;
+            fd = open(filename.c_str(), flags, 0644);
+        }
+
+        if (fd < 0)
+            return false;
+
+        // Not every filesystem can preallocate, the writes below still work without it
+        if (size > 0)
+            fallocate(fd, 0, 0, size);
+
+        // O_DIRECT needs aligned memory and lengths, data is staged through an aligned chunk
+        void *staging = nullptr;
+        if (direct && posix_memalign(&staging, DIRECT_ALIGN, WRITE_CHUNK) != 0)
+        {
+            close(fd);
+            return false;
+        }
+
+        bool ok = true;
+
+        for (size_t offset = 0; ok && offset < size; offset += WRITE_CHUNK)
+        {
+            size_t length = std::min(WRITE_CHUNK, size - offset);
+            const char *chunk = data + offset;
+            size_t toWrite = length;
+
+            if (direct)
+            {
+                // The last chunk is padded to the alignment and the file truncated back afterwards
+                toWrite = (length + DIRECT_ALIGN - 1) / DIRECT_ALIGN * DIRECT_ALIGN;
+                std::memcpy(staging, chunk, length);
+                std::memset(static_cast<char *>(staging) + length, 0, toWrite - length);
+                chunk = static_cast<const char *>(staging);
+            }
+
+            size_t written = 0;
+            while (ok && written < toWrite)
+            {
+                ssize_t n = pwrite(fd, chunk + written, toWrite - written, offset + written);
+                ok = n > 0;
+                if (ok)
+                    written += n;
+            }
+        }
+
+        free(staging);
+
+        if (ok && direct)
+            ok = ftruncate(fd, size) == 0;
+
+        if (ok && sync)
+            ok = fdatasync(fd) == 0;
+
+        close(fd);
+        return ok;
     }
 
     static std::vector<unsigned char> DiskToBuffer(const std::string &filename)
@@ -44,6 +134,56 @@ namespace File
 
         return buffer;
     }
+
+    /*
+        Read only, shared mapping of a whole file. Pages come straight from the page cache, so every
+        mapping of the same file shares them. Unmapped when the last reference is dropped.
+    */
+    class MappedFile
+    {
+    public:
+        static std::shared_ptr<const MappedFile> Open(const std::string &filename)
+        {
+            int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0)
+                return nullptr;
+
+            struct stat st;
+            if (fstat(fd, &st) != 0 || st.st_size <= 0)
+            {
+                close(fd);
+                return nullptr;
+            }
+
+            void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            close(fd);
+
+            if (data == MAP_FAILED)
+                return nullptr;
+
+            // Starts readahead now, on the thread opening the file, instead of faulting pages in while sending
+            madvise(data, st.st_size, MADV_WILLNEED);
+
+            return std::shared_ptr<const MappedFile>(new MappedFile(static_cast<const unsigned char *>(data), st.st_size));
+        }
+
+        ~MappedFile()
+        {
+            munmap(const_cast<unsigned char *>(m_data), m_size);
+        }
+
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+
+        inline const unsigned char *Data() const { return m_data; }
+        inline size_t Size() const { return m_size; }
+
+    private:
+        MappedFile(const unsigned char *data, size_t size) : m_data(data), m_size(size) {}
+
+        const unsigned char *m_data = nullptr;
+        size_t m_size = 0;
+    };
 }
 
 namespace String
@@ -52,30 +192,112 @@ namespace String
     {
         return std::vector<unsigned char>(str.begin(), str.end());
     }
-    static std::string HexToString(const std::vector<unsigned char> &bytes)
+    constexpr char HEX_DIGITS[] = "0123456789abcdef";
+
+    // Two hex digits of every byte value, so a byte is formatted with one lookup
+    constexpr auto HEX_TABLE = []
+    {
+        std::array<char, 512> table{};
+        for (int i = 0; i < 256; i++)
+        {
+            table[i * 2] = HEX_DIGITS[i >> 4];
+            table[i * 2 + 1] = HEX_DIGITS[i & 0xF];
+        }
+        return table;
+    }();
+
+    // Hex digits of a line offset, at least 4
+    static int OffsetWidth(size_t offset)
     {
-        std::stringstream ss;
-        ss << "\n\n0000: ";
+        int width = 4;
+        while (width < 16 && (offset >> (width * 4)) != 0)
+            width++;
+        return width;
+    }
 
-        int count = 0;
-        for (const unsigned char &byte : bytes)
+    /*
+        Writes 16 bytes per line, "oooo: xx xx ... ", for [from, to) of data, only full lines end with a newline.
+        Returns the end of what was written, the caller sizes the buffer with HexLinesLength
+    */
+    static char *HexLines(char *out, const unsigned char *data, size_t from, size_t to)
+    {
+        for (size_t line = from; line < to; line += 16)
         {
-            if (count % 16 == 0 && count != 0)
-            {
-                ss << std::setw(4) << std::setfill('0') << std::hex << static_cast<int>(count) << std::dec << ": ";
-            }
+            int width = OffsetWidth(line);
+            for (int i = width - 1; i >= 0; i--)
+                *out++ = HEX_DIGITS[(line >> (i * 4)) & 0xF];
 
-            ss << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(byte) << " ";
+            *out++ = ':';
+            *out++ = ' ';
 
-            count++;
-            if (count % 16 == 0)
+            size_t end = std::min(line + 16, to);
+            for (size_t i = line; i < end; i++)
             {
-                ss << "\n";
+                std::memcpy(out, &HEX_TABLE[data[i] * 2], 2);
+                out[2] = ' ';
+                out += 3;
             }
+
+            if (end - line == 16)
+                *out++ = '\n';
         }
+        return out;
+    }
 
-        ss << "\n";
-        return ss.str();
+    static size_t HexLinesLength(size_t from, size_t to)
+    {
+        size_t length = (to - from) * 3 + (to - from) / 16;
+        for (size_t line = from; line < to; line += 16)
+            length += OffsetWidth(line) + 2;
+        return length;
+    }
+
+    /*
+        Hex dump of a packet into out, reusing its storage. With maxBytes set and a bigger packet only the
+        first and last maxBytes / 2 bytes are dumped, with a line saying how many were left out in between.
+    */
+    static void HexDump(const unsigned char *data, size_t size, size_t maxBytes, std::string &out)
+    {
+        size_t head = size;
+        size_t tailStart = size;
+
+        if (maxBytes > 0 && size > maxBytes)
+        {
+            // Rounded up to whole lines, which can reach past a packet only a little bigger than maxBytes
+            head = std::min(size, (maxBytes / 2 + 15) / 16 * 16);
+            tailStart = std::max(head, (size - maxBytes / 2) / 16 * 16);
+        }
+
+        if (size == 0)
+        {
+            out = "\n\n0000: \n";
+            return;
+        }
+
+        std::string omitted = tailStart > head ? "... " + std::to_string(tailStart - head) + " BYTES OMITTED ...\n" : "";
+
+        // Head is whole lines, so the omitted line always starts on its own line
+        out.resize(2 + HexLinesLength(0, head) + omitted.size() + HexLinesLength(tailStart, size) + 1);
+        char *p = out.data();
+
+        *p++ = '\n';
+        *p++ = '\n';
+        p = HexLines(p, data, 0, head);
+
+        std::memcpy(p, omitted.data(), omitted.size());
+        p += omitted.size();
+
+        p = HexLines(p, data, tailStart, size);
+        *p++ = '\n';
+
+        out.resize(p - out.data());
+    }
+
+    static std::string HexToString(const std::vector<unsigned char> &bytes)
+    {
+        std::string out;
+        HexDump(bytes.data(), bytes.size(), 0, out);
+        return out;
     }
 }
 
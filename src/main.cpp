@@ -8,11 +8,21 @@ int main(int argc, char *argv[])
 {
    system("clear");
 
-   Logger *logger = new Logger();
-
-            
    PigeonData data(PATH_TO_CONFIG);
 
+   Clock::Get().SetTick(std::chrono::microseconds(data.GetConfig()->clockTick));
+
+   Logger *logger = new Logger(data.GetConfig()->logBuffer, data.GetConfig()->logOverflow);
+   logger->SetLevel(data.GetConfig()->logLevel);
+
+   if(!data.GetConfig()->logFile.empty() && !logger->OpenFile(data.GetConfig()->logFile, data.GetConfig()->logFileBytes, std::chrono::seconds(data.GetConfig()->logRotateSeconds)))
+      LOG(logger, ERROR, "Error while opening log file");
+
+   logger->SetConsole(data.GetConfig()->logConsole);
+
+   if(!data.GetConfig()->logBinary.empty() && !logger->OpenBinary(data.GetConfig()->logBinary))
+      LOG(logger, ERROR, "Error while opening binary log, logging as text");
+
    PigeonServer *server = new PigeonServer(data, logger);
    server->Run();
    
@@ -0,0 +1,338 @@
+//
+// Re-injects a capture written by the "capture" config option into a running server.
+//
+//   g++ -O2 -std=c++20 PigeonReplay.cpp -lssl -lcrypto -o PigeonReplay
+//   ./PigeonReplay <capture> [--host 127.0.0.1] [--port 4444] [--speed 1] [--linger 1] [--list]
+//
+// Every captured connection is replayed on its own TLS connection: it is opened on its first frame and closed
+// where the original one was closed. --speed 2 replays twice as fast as captured, --speed 0 sends every frame
+// as soon as the previous one is out; at that pace a user reconnecting can reach the server before its old connection
+// is gone and be refused as a collision. Whatever the server sends back is read and discarded so it never stalls
+// on a full socket. --list prints the records instead of replaying them.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+#include "../src/PacketCapture.h"
+
+using SteadyClock = std::chrono::steady_clock;
+
+struct Session
+{
+    int fd = -1;
+    SSL* ssl = nullptr;
+};
+
+struct Stats
+{
+    uint64_t frames = 0;
+    uint64_t bytes = 0;
+    uint64_t received = 0;
+    uint64_t sessions = 0;
+    uint64_t failed = 0;
+    uint64_t closedByServer = 0;
+};
+
+static SSL_CTX* ctx = nullptr;
+static std::unordered_map<int, Session> sessions;
+static Stats stats;
+
+static bool ReadRecord(std::ifstream& in, CaptureRecord& record, std::vector<unsigned char>& frame)
+{
+    if (!in.read(reinterpret_cast<char*>(&record), sizeof(record)))
+        return false;
+
+    frame.resize(record.length);
+    return record.length == 0 || static_cast<bool>(in.read(reinterpret_cast<char*>(frame.data()), record.length));
+}
+
+// [int HEADER_LENGTH][time_t TIME_STAMP][username\0][opcode][int CONTENT_LENGTH][payload]
+static void Describe(const std::vector<unsigned char>& frame, std::string& username, int& opcode)
+{
+    username.clear();
+    opcode = -1;
+
+    size_t offset = 4 + sizeof(int64_t);
+    while (offset < frame.size() && frame[offset] != 0)
+        username += static_cast<char>(frame[offset++]);
+
+    if (offset + 1 < frame.size())
+        opcode = frame[offset + 1];
+}
+
+static int List(std::ifstream& in)
+{
+    CaptureRecord record;
+    std::vector<unsigned char> frame;
+    std::string username;
+    int opcode;
+
+    while (ReadRecord(in, record, frame)) {
+        if (record.direction == CaptureDirection::CLOSE) {
+            std::printf("%12.3f ms  fd %-5d CLOSE\n", record.timeNs / 1e6, record.fd);
+            continue;
+        }
+
+        Describe(frame, username, opcode);
+        std::printf("%12.3f ms  fd %-5d IN    op 0x%02X  %8u bytes  %s\n", record.timeNs / 1e6, record.fd, opcode & 0xFF, record.length, username.c_str());
+    }
+
+    return 0;
+}
+
+static void Close(int capturedFd)
+{
+    auto it = sessions.find(capturedFd);
+    if (it == sessions.end())
+        return;
+
+    SSL_shutdown(it->second.ssl);
+    SSL_free(it->second.ssl);
+    close(it->second.fd);
+    sessions.erase(it);
+}
+
+static Session* Open(int capturedFd, const std::string& host, const std::string& port)
+{
+    addrinfo hints{};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    addrinfo* res = nullptr;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0)
+        return nullptr;
+
+    int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (fd < 0 || connect(fd, res->ai_addr, res->ai_addrlen) != 0) {
+        freeaddrinfo(res);
+        if (fd >= 0)
+            close(fd);
+        return nullptr;
+    }
+    freeaddrinfo(res);
+
+    SSL* ssl = SSL_new(ctx);
+    SSL_set_fd(ssl, fd);
+
+    if (SSL_connect(ssl) != 1) {
+        SSL_free(ssl);
+        close(fd);
+        return nullptr;
+    }
+
+    // Handshake is done blocking, from here reads and writes must not stall the other sessions
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    stats.sessions++;
+    return &(sessions[capturedFd] = Session{fd, ssl});
+}
+
+/*
+    Reads and discards what the server sent on every session, waiting up to timeoutMs for something to arrive.
+    Sessions the server closed are dropped.
+*/
+static void Drain(int timeoutMs)
+{
+    std::vector<pollfd> fds;
+    std::vector<int> keys;
+
+    for (auto& s : sessions) {
+        fds.push_back(pollfd{s.second.fd, POLLIN, 0});
+        keys.push_back(s.first);
+    }
+
+    if (fds.empty()) {
+        if (timeoutMs > 0)
+            poll(nullptr, 0, timeoutMs);
+        return;
+    }
+
+    if (poll(fds.data(), fds.size(), timeoutMs) <= 0)
+        return;
+
+    static unsigned char scratch[64 * 1024];
+
+    for (size_t i = 0; i < fds.size(); i++) {
+        if (fds[i].revents == 0)
+            continue;
+
+        SSL* ssl = sessions[keys[i]].ssl;
+        while (true) {
+            int n = SSL_read(ssl, scratch, sizeof(scratch));
+            if (n > 0) {
+                stats.received += n;
+                continue;
+            }
+
+            int error = SSL_get_error(ssl, n);
+            if (error != SSL_ERROR_WANT_READ && error != SSL_ERROR_WANT_WRITE) {
+                stats.closedByServer++;
+                Close(keys[i]);
+            }
+            break;
+        }
+    }
+}
+
+static bool Send(int capturedFd, const std::vector<unsigned char>& frame)
+{
+    size_t sent = 0;
+
+    while (sent < frame.size()) {
+        auto it = sessions.find(capturedFd);
+        if (it == sessions.end())
+            return false;
+
+        int n = SSL_write(it->second.ssl, frame.data() + sent, frame.size() - sent);
+        if (n > 0) {
+            sent += n;
+            continue;
+        }
+
+        int error = SSL_get_error(it->second.ssl, n);
+        if (error != SSL_ERROR_WANT_READ && error != SSL_ERROR_WANT_WRITE)
+            return false;
+
+        // Server is not reading yet, keep the other sessions moving while waiting for room
+        Drain(1);
+    }
+
+    return true;
+}
+
+static void Usage()
+{
+    std::cerr << "usage: PigeonReplay <capture> [--host 127.0.0.1] [--port 4444] [--speed 1] [--linger 1] [--list]" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        Usage();
+        return 1;
+    }
+
+    std::string path = argv[1];
+    std::string host = "127.0.0.1";
+    std::string port = "4444";
+    double speed = 1;
+    double linger = 1;
+    bool list = false;
+
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (arg == "--list")
+            list = true;
+        else if (arg == "--host" && i + 1 < argc)
+            host = argv[++i];
+        else if (arg == "--port" && i + 1 < argc)
+            port = argv[++i];
+        else if (arg == "--speed" && i + 1 < argc)
+            speed = std::atof(argv[++i]);
+        else if (arg == "--linger" && i + 1 < argc)
+            linger = std::atof(argv[++i]);
+        else {
+            Usage();
+            return 1;
+        }
+    }
+
+    std::ifstream in(path, std::ios::binary);
+    CaptureHeader header;
+
+    if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) || std::memcmp(header.magic, CAPTURE_MAGIC, sizeof(header.magic)) != 0) {
+        std::cerr << path << " is not a capture file" << std::endl;
+        return 1;
+    }
+
+    if (list)
+        return List(in);
+
+    signal(SIGPIPE, SIG_IGN);
+
+    ctx = SSL_CTX_new(TLS_client_method());
+    // Replays go against local servers with self signed certificates
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, nullptr);
+
+    CaptureRecord record;
+    std::vector<unsigned char> frame;
+    auto start = SteadyClock::now();
+
+    // Idle time before the first captured frame is skipped
+    bool first = true;
+    uint64_t firstNs = 0;
+
+    while (ReadRecord(in, record, frame)) {
+        if (first) {
+            firstNs = record.timeNs;
+            first = false;
+        }
+
+        if (speed > 0) {
+            auto due = start + std::chrono::nanoseconds(static_cast<int64_t>((record.timeNs - firstNs) / speed));
+
+            for (auto now = SteadyClock::now(); now < due; now = SteadyClock::now())
+                Drain(std::max<int>(1, std::chrono::duration_cast<std::chrono::milliseconds>(due - now).count()));
+        }
+
+        if (record.direction == CaptureDirection::CLOSE) {
+            Close(record.fd);
+            continue;
+        }
+
+        if (sessions.find(record.fd) == sessions.end() && Open(record.fd, host, port) == nullptr) {
+            stats.failed++;
+            continue;
+        }
+
+        if (!Send(record.fd, frame)) {
+            stats.failed++;
+            Close(record.fd);
+            continue;
+        }
+
+        stats.frames++;
+        stats.bytes += frame.size();
+        Drain(0);
+    }
+
+    auto end = SteadyClock::now();
+
+    for (auto lingerEnd = end + std::chrono::duration<double>(linger); SteadyClock::now() < lingerEnd && !sessions.empty();)
+        Drain(10);
+
+    while (!sessions.empty())
+        Close(sessions.begin()->first);
+
+    SSL_CTX_free(ctx);
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    std::printf("%llu frames, %llu bytes sent in %.3f s (%.0f frames/s) over %llu connections\n", static_cast<unsigned long long>(stats.frames),
+                static_cast<unsigned long long>(stats.bytes), seconds, seconds > 0 ? stats.frames / seconds : 0.0, static_cast<unsigned long long>(stats.sessions));
+    std::printf("%llu bytes received, %llu frames failed, %llu connections closed by the server\n", static_cast<unsigned long long>(stats.received),
+                static_cast<unsigned long long>(stats.failed), static_cast<unsigned long long>(stats.closedByServer));
+
+    return 0;
+}